@@ -0,0 +1,14 @@
+#include "benchmark/benchmark.h"
+#include "src/lib/trojanmap.h"
+
+// Time to load data.csv and rebuild the indices over it; the argument is the
+// parser thread count.
+static void BM_LoadMap(benchmark::State &state) {
+  TrojanMap m;
+  for (auto _ : state) m.LoadMap("src/lib/data.csv", state.range(0));
+  state.counters["nodes"] = m.data.size();
+}
+BENCHMARK(BM_LoadMap)
+    ->Arg(1)->Arg(2)->Arg(4)->Arg(8)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,57 @@
+#include <random>
+
+#include "benchmark/benchmark.h"
+#include "src/lib/trojanmap.h"
+
+// Run from the repository root so that src/lib/data.csv is found:
+//   bazel run -c opt //benchmarks:tsp_benchmark
+
+// Distance matrix over n random locations of the map, the same set for every
+// solver with the same n.
+static std::vector<std::string> RandomIds(TrojanMap &m, int n) {
+  std::mt19937 gen(n);
+  std::uniform_int_distribution<int> pick(0, m.index_to_id.size() - 1);
+  std::vector<std::string> stops;
+  for (int i = 0; i < n; i++) stops.push_back(m.index_to_id[pick(gen)]);
+  return stops;
+}
+
+static DistanceMatrix RandomStops(TrojanMap &m, int n) {
+  return m.BuildDistanceMatrix(RandomIds(m, n));
+}
+
+static TrojanMap &Map() {
+  static TrojanMap m;
+  return m;
+}
+
+static void BM_TSP_2opt(benchmark::State &state) {
+  DistanceMatrix dist = RandomStops(Map(), state.range(0));
+  double length = 0;
+  for (auto _ : state) length = Map().TSP_2opt(dist).first;
+  state.counters["miles"] = length;
+}
+BENCHMARK(BM_TSP_2opt)->Arg(100)->Arg(500)->Arg(2000)->Unit(benchmark::kMillisecond);
+
+static void BM_TSP_3opt(benchmark::State &state) {
+  DistanceMatrix dist = RandomStops(Map(), state.range(0));
+  double length = 0;
+  for (auto _ : state) length = Map().TSP_3opt(dist).first;
+  state.counters["miles"] = length;
+}
+BENCHMARK(BM_TSP_3opt)->Arg(100)->Arg(500)->Arg(2000)->Unit(benchmark::kMillisecond);
+
+// Seed construction time and length; the first argument is the TourSeed.
+static void BM_TSP_InitialTour(benchmark::State &state) {
+  TourSeed seed = static_cast<TourSeed>(state.range(0));
+  std::vector<std::string> ids = RandomIds(Map(), state.range(1));
+  DistanceMatrix dist = Map().BuildDistanceMatrix(ids);
+  auto coords = Map().GetCoordinates(ids);
+  std::vector<int> order;
+  for (auto _ : state) order = Map().TSP_InitialTour(dist, seed, coords);
+  order.push_back(order[0]);
+  state.counters["miles"] = TrojanMap::TourLength(dist, order);
+}
+BENCHMARK(BM_TSP_InitialTour)
+    ->ArgsProduct({{0, 1, 2, 3, 4}, {500, 2000}})
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,286 @@
+#include "maprenderer.h"
+
+/**
+ * MapRenderer: Cut the viewport out of map.png and project every node once.
+ *
+ * @param  {TrojanMap} map        : the map to draw
+ * @param  {Viewport} viewport    : area and image size
+ * @param  {cv::Mat} map_image    : decoded map.png, or empty to read it
+ */
+MapRenderer::MapRenderer(const TrojanMap &map, const Viewport &viewport,
+                         const cv::Mat &map_image)
+    : map(map), viewport(viewport) {
+  cv::Mat png_image = map_image;
+  if (png_image.empty()) {
+    std::string image_path = cv::samples::findFile("src/lib/map.png");
+    png_image = cv::imread(image_path, cv::IMREAD_COLOR);
+  }
+  const Viewport png;  // the area and size map.png was rendered for
+  if (viewport == png || png_image.empty()) {
+    base_image = png_image;
+  } else {
+    // Affine map from map.png pixels to viewport pixels.
+    double lon_span = viewport.max_lon - viewport.min_lon;
+    double lat_span = viewport.max_lat - viewport.min_lat;
+    cv::Mat m(2, 3, CV_64F, cv::Scalar(0));
+    m.at<double>(0, 0) = (png.max_lon - png.min_lon) / png_image.cols /
+                         lon_span * viewport.width;
+    m.at<double>(0, 2) =
+        (png.min_lon - viewport.min_lon) / lon_span * viewport.width;
+    m.at<double>(1, 1) = (png.max_lat - png.min_lat) / png_image.rows /
+                         lat_span * viewport.height;
+    m.at<double>(1, 2) =
+        (viewport.max_lat - png.max_lat) / lat_span * viewport.height;
+    cv::warpAffine(png_image, base_image, m,
+                   cv::Size(viewport.width, viewport.height), cv::INTER_AREA,
+                   cv::BORDER_CONSTANT, cv::Scalar(255, 255, 255));
+  }
+
+  int n = map.index_to_id.size();
+  node_pixels.resize(n);
+  for (int i = 0; i < n; i++) {
+    auto p = GetPlotLocation(map.node_lat[i], map.node_lon[i]);
+    node_pixels[i] = cv::Point(int(p.first), int(p.second));
+  }
+}
+
+/**
+ * RoadLayer: The map with every road and location drawn in, as PlotMap shows
+ * it. Drawn by the first caller; the others wait for it.
+ *
+ * @return {cv::Mat}  : the road layer; do not draw on it
+ */
+const cv::Mat &MapRenderer::RoadLayer() const {
+  std::call_once(road_layer_once, [this]() {
+    cv::Mat img = base_image.clone();
+    for (int u = 0; u < int(node_pixels.size()); u++) {
+      for (int e = map.adj_offset[u]; e < map.adj_offset[u + 1]; e++) {
+        cv::line(img, node_pixels[u], node_pixels[map.adj_target[e]],
+                 cv::Scalar(0, 255, 0), 3);
+      }
+      cv::circle(img, node_pixels[u], 5, cv::Scalar(0, 0, 255), cv::FILLED);
+    }
+    road_layer = img;
+  });
+  return road_layer;
+}
+
+/**
+ * GetPixel: Pixel position of a location in the viewport
+ *
+ * @param  {std::string} id : location id
+ * @return {cv::Point}      : position, or (-1, -1) for an unknown id
+ */
+cv::Point MapRenderer::GetPixel(const std::string &id) const {
+  auto it = map.id_to_index.find(id);
+  if (it == map.id_to_index.end()) return cv::Point(-1, -1);
+  return node_pixels[it->second];
+}
+
+/**
+ * GetPixels: Pixel positions of the known locations, in order
+ *
+ * @param  {std::vector<std::string>} ids : location ids
+ * @return {std::vector<cv::Point>}      : positions; unknown ids are skipped
+ */
+std::vector<cv::Point> MapRenderer::GetPixels(
+    const std::vector<std::string> &ids) const {
+  std::vector<cv::Point> pixels;
+  pixels.reserve(ids.size());
+  for (auto &id : ids) {
+    auto it = map.id_to_index.find(id);
+    if (it != map.id_to_index.end()) pixels.push_back(node_pixels[it->second]);
+  }
+  return pixels;
+}
+
+/**
+ * GetPlotLocation: Transform the location to the position on the map
+ *
+ * @param  {double} lat         : latitude
+ * @param  {double} lon         : longitude
+ * @return {std::pair<double, double>}  : position on the map
+ */
+std::pair<double, double> MapRenderer::GetPlotLocation(double lat,
+                                                       double lon) const {
+  double h = viewport.max_lat - viewport.min_lat;
+  double w = viewport.max_lon - viewport.min_lon;
+  std::pair<double, double> result(
+      (lon - viewport.min_lon) / w * viewport.width,
+      (1 - (lat - viewport.min_lat) / h) * viewport.height);
+  return result;
+}
+
+/**
+ * DrawPath: Draw a route given in pixels: a dot on every stop and a line
+ * between consecutive ones.
+ *
+ * @param  {cv::Mat} img                 : the image to draw into
+ * @param  {std::vector<cv::Point>} path : the stops
+ */
+void MapRenderer::DrawPath(cv::Mat &img, const std::vector<cv::Point> &path) {
+  if (path.empty()) return;
+  cv::circle(img, path[0], DOT_SIZE, cv::Scalar(0, 0, 255), cv::FILLED);
+  for (size_t i = 1; i < path.size(); i++) {
+    cv::circle(img, path[i], DOT_SIZE, cv::Scalar(0, 0, 255), cv::FILLED);
+    cv::line(img, path[i - 1], path[i], cv::Scalar(0, 255, 0), LINE_WIDTH);
+  }
+}
+
+/**
+ * RenderRoute: Draw a route on a copy of the map
+ *
+ * @param  {std::vector<std::string>} location_ids : the route
+ * @return {cv::Mat}                               : the image
+ */
+cv::Mat MapRenderer::RenderRoute(
+    const std::vector<std::string> &location_ids) const {
+  cv::Mat img = base_image.clone();
+  DrawPath(img, GetPixels(location_ids));
+  return img;
+}
+
+/**
+ * RenderPoints: Draw locations on a copy of the map
+ *
+ * @param  {std::vector<std::string>} location_ids : the locations
+ * @return {cv::Mat}                               : the image
+ */
+cv::Mat MapRenderer::RenderPoints(
+    const std::vector<std::string> &location_ids) const {
+  cv::Mat img = base_image.clone();
+  for (auto &p : GetPixels(location_ids)) {
+    cv::circle(img, p, DOT_SIZE, cv::Scalar(0, 0, 255), cv::FILLED);
+  }
+  return img;
+}
+
+/**
+ * RenderOrder: Draw a route with arrows and the name of every stop
+ *
+ * @param  {std::vector<std::string>} location_ids : the route
+ * @return {cv::Mat}                               : the image
+ */
+cv::Mat MapRenderer::RenderOrder(
+    const std::vector<std::string> &location_ids) const {
+  cv::Mat img = base_image.clone();
+  for (auto &id : location_ids) {
+    auto it = map.id_to_index.find(id);
+    if (it == map.id_to_index.end()) continue;
+    cv::putText(img, map.data.at(id).name, node_pixels[it->second],
+                cv::FONT_HERSHEY_DUPLEX, 1.0, CV_RGB(255, 0, 0), 2);
+  }
+  std::vector<cv::Point> path = GetPixels(location_ids);
+  if (path.empty()) return img;
+  cv::circle(img, path[0], DOT_SIZE, cv::Scalar(0, 0, 255), cv::FILLED);
+  for (size_t i = 1; i < path.size(); i++) {
+    cv::circle(img, path[i], DOT_SIZE, cv::Scalar(0, 0, 255), cv::FILLED);
+    cv::arrowedLine(img, path[i - 1], path[i], cv::Scalar(0, 255, 0),
+                    LINE_WIDTH);
+  }
+  return img;
+}
+
+/**
+ * RenderLabels: Draw the origin in green and number the locations from 1.
+ * An unknown id keeps its number but is not drawn.
+ *
+ * @param  {std::vector<std::string>} location_ids : the locations
+ * @param  {std::string} origin                    : the origin id
+ * @return {cv::Mat}                               : the image
+ */
+cv::Mat MapRenderer::RenderLabels(const std::vector<std::string> &location_ids,
+                                  const std::string &origin) const {
+  cv::Mat img = base_image.clone();
+  for (auto &p : GetPixels({origin})) {
+    cv::circle(img, p, DOT_SIZE, cv::Scalar(0, 255, 0), cv::FILLED);
+  }
+  int cnt = 0;
+  for (auto &id : location_ids) {
+    cnt++;
+    auto it = map.id_to_index.find(id);
+    if (it == map.id_to_index.end()) continue;
+    auto p = node_pixels[it->second];
+    cv::circle(img, p, DOT_SIZE, cv::Scalar(0, 0, 255), cv::FILLED);
+    cv::putText(img, std::to_string(cnt), p, cv::FONT_HERSHEY_DUPLEX, 1.0,
+                CV_RGB(255, 0, 0), 2);
+  }
+  return img;
+}
+
+/**
+ * RenderPointsAndEdges: Draw the square, the locations and their roads to
+ * other nodes inside the square
+ *
+ * @param  {std::vector<std::string>} location_ids : the locations
+ * @param  {std::vector<double>} square            : the boundary
+ * @return {cv::Mat}                               : the image
+ */
+cv::Mat MapRenderer::RenderPointsAndEdges(
+    const std::vector<std::string> &location_ids,
+    const std::vector<double> &square) const {
+  cv::Mat img = base_image.clone();
+  if (square.size() < 4) return img;
+  auto upperleft = GetPlotLocation(square[2], square[0]);
+  auto lowerright = GetPlotLocation(square[3], square[1]);
+  cv::rectangle(img, cv::Point(int(lowerright.first), int(lowerright.second)),
+                cv::Point(int(upperleft.first), int(upperleft.second)),
+                cv::Scalar(0, 0, 255));
+  for (auto &id : location_ids) {
+    auto it = map.id_to_index.find(id);
+    if (it == map.id_to_index.end()) continue;
+    int u = it->second;
+    cv::circle(img, node_pixels[u], DOT_SIZE, cv::Scalar(0, 0, 255),
+               cv::FILLED);
+    for (int e = map.adj_offset[u]; e < map.adj_offset[u + 1]; e++) {
+      int v = map.adj_target[e];
+      if (map.node_lon[v] < square[0] || map.node_lon[v] > square[1] ||
+          map.node_lat[v] > square[2] || map.node_lat[v] < square[3]) {
+        continue;
+      }
+      cv::line(img, node_pixels[u], node_pixels[v], cv::Scalar(0, 255, 0),
+               LINE_WIDTH);
+    }
+  }
+  return img;
+}
+
+/**
+ * RenderRegion: RenderPointsAndEdges for every location inside the square
+ *
+ * @param  {std::vector<double>} square : {left lon, right lon, upper lat,
+ * lower lat}
+ * @return {cv::Mat}                    : the image
+ */
+cv::Mat MapRenderer::RenderRegion(const std::vector<double> &square) const {
+  std::vector<std::string> inside;
+  if (square.size() >= 4) {
+    for (size_t i = 0; i < map.index_to_id.size(); i++) {
+      if (map.node_lon[i] < square[0] || map.node_lon[i] > square[1] ||
+          map.node_lat[i] > square[2] || map.node_lat[i] < square[3]) {
+        continue;
+      }
+      inside.push_back(map.index_to_id[i]);
+    }
+  }
+  return RenderPointsAndEdges(inside, square);
+}
+
+/**
+ * Encode: Compress an image in memory
+ *
+ * @param  {cv::Mat} img         : the image
+ * @param  {std::string} ext     : ".png", ".jpg", ...
+ * @param  {int} quality         : JPEG quality, 0-100
+ * @return {std::vector<uchar>}  : the file contents, empty on failure
+ */
+std::vector<uchar> MapRenderer::Encode(const cv::Mat &img,
+                                       const std::string &ext, int quality) {
+  std::vector<uchar> bytes;
+  std::vector<int> params;
+  if (ext == ".jpg" || ext == ".jpeg") {
+    params = {cv::IMWRITE_JPEG_QUALITY, quality};
+  }
+  if (img.empty() || !cv::imencode(ext, img, bytes, params)) bytes.clear();
+  return bytes;
+}
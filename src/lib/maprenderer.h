@@ -0,0 +1,90 @@
+#ifndef MapRenderer_H
+#define MapRenderer_H
+#define DOT_SIZE 5
+#define LINE_WIDTH 3
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include "trojanmap.h"
+#include "opencv2/core.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/imgproc.hpp"
+
+// The part of the map that is drawn and the size of the image it is drawn
+// into. The defaults are the area and size of map.png.
+class Viewport {
+ public:
+  double min_lat = 33.999, max_lat = 34.041;
+  double min_lon = -118.321, max_lon = -118.249;
+  int width = 1280, height = 900;
+  bool operator==(const Viewport &v) const {
+    return min_lat == v.min_lat && max_lat == v.max_lat &&
+           min_lon == v.min_lon && max_lon == v.max_lon && width == v.width &&
+           height == v.height;
+  }
+  bool operator!=(const Viewport &v) const { return !(*this == v); }
+};
+
+// Offscreen drawing of a TrojanMap for one viewport. The base image and the
+// pixel position of every node are prepared by the constructor and every
+// Render call only reads them, so one renderer can serve any number of
+// threads at once. Nothing here uses HighGUI, so it also works without a
+// display.
+class MapRenderer {
+ public:
+  // map must outlive the renderer and not change meanwhile. map_image is the
+  // decoded map.png; it is read from src/lib/map.png when empty.
+  MapRenderer(const TrojanMap &map, const Viewport &viewport = Viewport(),
+              const cv::Mat &map_image = cv::Mat());
+
+  const Viewport &GetViewport() const { return viewport; }
+
+  // The map for the viewport, and the same with every road and location
+  // drawn in (built on first use). Copy before drawing on them.
+  const cv::Mat &BaseImage() const { return base_image; }
+  const cv::Mat &RoadLayer() const;
+
+  // Pixel positions by node index, and of one location ((-1, -1) if unknown).
+  const std::vector<cv::Point> &NodePixels() const { return node_pixels; }
+  cv::Point GetPixel(const std::string &id) const;
+  // Pixel positions of the known locations in order; unknown ids are left
+  // out. Every Render method skips unknown ids the same way.
+  std::vector<cv::Point> GetPixels(const std::vector<std::string> &ids) const;
+  std::pair<double, double> GetPlotLocation(double lat, double lon) const;
+
+  // A route: dots on the stops joined by lines.
+  cv::Mat RenderRoute(const std::vector<std::string> &location_ids) const;
+  // Dots on the locations.
+  cv::Mat RenderPoints(const std::vector<std::string> &location_ids) const;
+  // A route drawn with arrows and the name of every stop.
+  cv::Mat RenderOrder(const std::vector<std::string> &location_ids) const;
+  // The origin in green and the locations numbered from 1.
+  cv::Mat RenderLabels(const std::vector<std::string> &location_ids,
+                       const std::string &origin) const;
+  // The square {left lon, right lon, upper lat, lower lat}, the given
+  // locations and the roads between those and other nodes inside it.
+  cv::Mat RenderPointsAndEdges(const std::vector<std::string> &location_ids,
+                               const std::vector<double> &square) const;
+  // Same for every location inside the square.
+  cv::Mat RenderRegion(const std::vector<double> &square) const;
+
+  // Draw a route given in pixels onto img.
+  static void DrawPath(cv::Mat &img, const std::vector<cv::Point> &path);
+
+  // Compress img for a file extension such as ".png" or ".jpg"; quality is
+  // the JPEG quality (0-100). Empty on failure.
+  static std::vector<uchar> Encode(const cv::Mat &img,
+                                   const std::string &ext = ".png",
+                                   int quality = 95);
+
+ private:
+  const TrojanMap &map;
+  Viewport viewport;
+  cv::Mat base_image;
+  std::vector<cv::Point> node_pixels;
+  mutable std::once_flag road_layer_once;
+  mutable cv::Mat road_layer;
+};
+
+#endif
@@ -1,4 +1,7 @@
 #include "mapui.h"
+
+#include <condition_variable>
+#include <mutex>
 /**
  * PrintMenu: Create the menu
  * 
@@ -265,14 +268,16 @@ void MapUI::PrintMenu() {
     PlotPointsandEdges(subgraph, square);
     
     auto start = std::chrono::high_resolution_clock::now();
-    auto results = map.CycleDetection(subgraph, square);
+    std::vector<std::string> cycle;
+    auto results = map.CycleDetection(subgraph, square, &cycle);
     auto stop = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
     menu = "*************************Results******************************\n";
     std::cout << menu;
-    if (results == true)
+    if (results == true) {
       std::cout << "there exists a cycle in the subgraph " << std::endl;
-    else
+      PlotPointsandEdges(cycle, square);
+    } else
       std::cout << "there exist no cycle in the subgraph " << std::endl;
     menu = "**************************************************************\n";
     std::cout << menu;
@@ -309,7 +314,8 @@ void MapUI::PrintMenu() {
       dependencies = map.ReadDependenciesFromCSVFile(dependencies_filename);
 
     auto start = std::chrono::high_resolution_clock::now();
-    auto result = map.DeliveringTrojan(location_names, dependencies);
+    std::vector<std::string> cycle;
+    auto result = map.DeliveringTrojan(location_names, dependencies, &cycle);
     auto stop = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
     std::cout << "*************************Results******************************\n";
@@ -321,6 +327,10 @@ void MapUI::PrintMenu() {
       PlotPointsOrder(node_ids);
     } else {
       std::cout << "There is no topological sort for the given graph.\n";
+      if (!cycle.empty()) {
+        std::cout << "These locations depend on each other in a cycle:" << std::endl;
+        for (auto x : cycle) std::cout << x << std::endl;
+      }
     }
     std::cout << "**************************************************************\n";
     std::cout << "Time taken by function: " << duration.count()/1000 << " ms" << std::endl << std::endl;
@@ -396,10 +406,11 @@ void MapUI::PrintMenu() {
     
     std::cout << "Calculating ..." << std::endl;
     start = std::chrono::high_resolution_clock::now();
-    results = map.TravelingTrojan_2opt(locations);
+    TSPProgress progress;
+    results = map.TravelingTrojan_2opt(locations, TourSeed::kGreedyEdge, &progress);
     stop = std::chrono::high_resolution_clock::now();
     duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-    CreateAnimation(results.second, "output0_2opt.avi");
+    CreateAnimation(progress, locations, "output0_2opt.avi");
     menu = "*************************Results******************************\n";
     std::cout << menu;
     menu = "TravelingTrojan_2opt\n";
@@ -485,15 +496,7 @@ void MapUI::PrintMenu() {
  * @param  {std::string} id : location id
  */
 void MapUI::PlotPoint(std::string id) {
-  std::string image_path = cv::samples::findFile("src/lib/map.png");
-  cv::Mat img = cv::imread(image_path, cv::IMREAD_COLOR);
-  // cv::resize(img, img, cv::Size(img.cols, img.rows));
-  auto result = GetPlotLocation(map.data[id].lat, map.data[id].lon);
-  cv::circle(img, cv::Point(result.first, result.second), DOT_SIZE,
-             cv::Scalar(0, 0, 255), cv::FILLED);
-  cv::startWindowThread();
-  cv::imshow("TrojanMap", img);
-  cv::waitKey(1);
+  Show(Renderer().RenderPoints({id}));
 }
 /**
  * PlotPoint: Given a lat and a lon, plot the point on the map
@@ -502,15 +505,11 @@ void MapUI::PlotPoint(std::string id) {
  * @param  {double} lon : longitude
  */
 void MapUI::PlotPoint(double lat, double lon) {
-  std::string image_path = cv::samples::findFile("src/lib/map.png");
-  cv::Mat img = cv::imread(image_path, cv::IMREAD_COLOR);
-  // cv::resize(img, img, cv::Size(img.cols, img.rows));
+  cv::Mat img = BaseImage().clone();
   auto result = GetPlotLocation(lat, lon);
   cv::circle(img, cv::Point(int(result.first), int(result.second)), DOT_SIZE,
              cv::Scalar(0, 0, 255), cv::FILLED);
-  cv::startWindowThread();
-  cv::imshow("TrojanMap", img);
-  cv::waitKey(1);
+  Show(img);
 }
 
 /**
@@ -519,24 +518,7 @@ void MapUI::PlotPoint(double lat, double lon) {
  * @param  {std::vector<std::string>} location_ids : path
  */
 void MapUI::PlotPath(std::vector<std::string> &location_ids) {
-  std::string image_path = cv::samples::findFile("src/lib/map.png");
-  cv::Mat img = cv::imread(image_path, cv::IMREAD_COLOR);
-  // cv::resize(img, img, cv::Size(img.cols, img.rows));
-  auto start = GetPlotLocation(map.data[location_ids[0]].lat, map.data[location_ids[0]].lon);
-  cv::circle(img, cv::Point(int(start.first), int(start.second)), DOT_SIZE,
-             cv::Scalar(0, 0, 255), cv::FILLED);
-  for (auto i = 1; i < int(location_ids.size()); i++) {
-    auto start = GetPlotLocation(map.data[location_ids[i - 1]].lat, map.data[location_ids[i - 1]].lon);
-    auto end = GetPlotLocation(map.data[location_ids[i]].lat, map.data[location_ids[i]].lon);
-    cv::circle(img, cv::Point(int(end.first), int(end.second)), DOT_SIZE,
-               cv::Scalar(0, 0, 255), cv::FILLED);
-    cv::line(img, cv::Point(int(start.first), int(start.second)),
-             cv::Point(int(end.first), int(end.second)), cv::Scalar(0, 255, 0),
-             LINE_WIDTH);
-  }
-  cv::startWindowThread();
-  cv::imshow("TrojanMap", img);
-  cv::waitKey(1);
+  Show(Renderer().RenderRoute(location_ids));
 }
 
 /**
@@ -545,48 +527,16 @@ void MapUI::PlotPath(std::vector<std::string> &location_ids) {
  * @param  {std::vector<std::string>} location_ids : points
  */
 void MapUI::PlotPoints(std::vector<std::string> &location_ids) {
-  std::string image_path = cv::samples::findFile("src/lib/map.png");
-  cv::Mat img = cv::imread(image_path, cv::IMREAD_COLOR);
-  // cv::resize(img, img, cv::Size(img.cols, img.rows));
-  for (auto x : location_ids) {
-    auto result = GetPlotLocation(map.data[x].lat, map.data[x].lon);
-    cv::circle(img, cv::Point(result.first, result.second), DOT_SIZE,
-               cv::Scalar(0, 0, 255), cv::FILLED);
-  }
-  cv::startWindowThread();
-  cv::imshow("TrojanMap", img);
-  cv::waitKey(1);
+  Show(Renderer().RenderPoints(location_ids));
 }
 
 
 /**
- * PlotPoints: Given a vector of location ids draws the points on the map (no path).
+ * PlotMap: Plot every road and location of the map
  * 
- * @param  {std::vector<std::string>} location_ids : points inside square
- * @param  {std::vector<double>} square : boundary
  */
 void MapUI::PlotMap() {
-  std::string image_path = cv::samples::findFile("src/lib/map.png");
-  cv::Mat img = cv::imread(image_path, cv::IMREAD_COLOR);
-  // cv::resize(img, img, cv::Size(img.cols, img.rows));
-  for (auto& kv : map.data) {
-    auto x = kv.first;
-    if (map.data.count(x) == 0)
-      std::cout << x << std::endl;
-    auto result = GetPlotLocation(map.data[x].lat, map.data[x].lon);
-    for(auto& y : map.data[x].neighbors) {
-      auto start = GetPlotLocation(map.data[x].lat, map.data[x].lon);
-      auto end = GetPlotLocation(map.data[y].lat, map.data[y].lon);
-      cv::line(img, cv::Point(int(start.first), int(start.second)),
-              cv::Point(int(end.first), int(end.second)), cv::Scalar(0, 255, 0),
-              3);
-    }
-    cv::circle(img, cv::Point(result.first, result.second), 5,
-            cv::Scalar(0, 0, 255), cv::FILLED);
-  }
-  cv::startWindowThread();
-  cv::imshow("TrojanMap", img);
-  cv::waitKey(1);
+  Show(RoadLayer());
 }
 
 /**
@@ -596,30 +546,7 @@ void MapUI::PlotMap() {
  * @param  {std::vector<double>} square : boundary
  */
 void MapUI::PlotPointsandEdges(std::vector<std::string> &location_ids, std::vector<double> &square) {
-  std::string image_path = cv::samples::findFile("src/lib/map.png");
-  cv::Mat img = cv::imread(image_path, cv::IMREAD_COLOR);
-  // cv::resize(img, img, cv::Size(img.cols, img.rows));
-  auto upperleft = GetPlotLocation(square[2], square[0]);
-  auto lowerright = GetPlotLocation(square[3], square[1]);
-  cv::Point pt1(int(upperleft.first), int(upperleft.second));
-  cv::Point pt2(int(lowerright.first), int(lowerright.second));
-  cv::rectangle(img, pt2, pt1, cv::Scalar(0, 0, 255));
-  for (auto x : location_ids) {
-    auto result = GetPlotLocation(map.data[x].lat, map.data[x].lon);
-    cv::circle(img, cv::Point(result.first, result.second), DOT_SIZE,
-               cv::Scalar(0, 0, 255), cv::FILLED);
-    for(auto y : map.data[x].neighbors) {
-      if (map.inSquare(y, square) == false) continue;
-      auto start = GetPlotLocation(map.data[x].lat, map.data[x].lon);
-      auto end = GetPlotLocation(map.data[y].lat, map.data[y].lon);
-      cv::line(img, cv::Point(int(start.first), int(start.second)),
-              cv::Point(int(end.first), int(end.second)), cv::Scalar(0, 255, 0),
-              LINE_WIDTH);
-    }
-  }
-  cv::startWindowThread();
-  cv::imshow("TrojanMap", img);
-  cv::waitKey(1);
+  Show(Renderer().RenderPointsAndEdges(location_ids, square));
 }
 
 /**
@@ -628,29 +555,7 @@ void MapUI::PlotPointsandEdges(std::vector<std::string> &location_ids, std::vect
  * @param  {std::vector<std::string>} location_ids : points
  */
 void MapUI::PlotPointsOrder(std::vector<std::string> &location_ids) {
-  std::string image_path = cv::samples::findFile("src/lib/map.png");
-  cv::Mat img = cv::imread(image_path, cv::IMREAD_COLOR);
-  // cv::resize(img, img, cv::Size(img.cols, img.rows));
-  for (auto x : location_ids) {
-    auto result = GetPlotLocation(map.data[x].lat, map.data[x].lon);
-    cv::putText(img, map.data[x].name, cv::Point(result.first, result.second), cv::FONT_HERSHEY_DUPLEX, 1.0, CV_RGB(255, 0, 0), 2);
-  }
-  // Plot dots and lines
-  auto start = GetPlotLocation(map.data[location_ids[0]].lat, map.data[location_ids[0]].lon);
-  cv::circle(img, cv::Point(int(start.first), int(start.second)), DOT_SIZE,
-             cv::Scalar(0, 0, 255), cv::FILLED);
-  for (auto i = 1; i < int(location_ids.size()); i++) {
-    auto start = GetPlotLocation(map.data[location_ids[i - 1]].lat, map.data[location_ids[i - 1]].lon);
-    auto end = GetPlotLocation(map.data[location_ids[i]].lat, map.data[location_ids[i]].lon);
-    cv::circle(img, cv::Point(int(end.first), int(end.second)), DOT_SIZE,
-               cv::Scalar(0, 0, 255), cv::FILLED);
-    cv::arrowedLine(img, cv::Point(int(start.first), int(start.second)),
-             cv::Point(int(end.first), int(end.second)), cv::Scalar(0, 255, 0),
-             LINE_WIDTH);
-  }
-  cv::startWindowThread();
-  cv::imshow("TrojanMap", img);
-  cv::waitKey(1);
+  Show(Renderer().RenderOrder(location_ids));
 }
 
 /**
@@ -659,58 +564,285 @@ void MapUI::PlotPointsOrder(std::vector<std::string> &location_ids) {
  * @param  {std::vector<std::string>} location_ids : points
  */
 void MapUI::PlotPointsLabel(std::vector<std::string> &location_ids, std::string origin) {
-  std::string image_path = cv::samples::findFile("src/lib/map.png");
-  cv::Mat img = cv::imread(image_path, cv::IMREAD_COLOR);
-  // cv::resize(img, img, cv::Size(img.cols, img.rows));
-  int cnt = 1;
-  auto result = GetPlotLocation(map.data[origin].lat, map.data[origin].lon);
-  cv::circle(img, cv::Point(result.first, result.second), DOT_SIZE,
-               cv::Scalar(0, 255, 0), cv::FILLED);
-  for (auto x : location_ids) {
-    auto result = GetPlotLocation(map.data[x].lat, map.data[x].lon);
-    cv::circle(img, cv::Point(result.first, result.second), DOT_SIZE,
-               cv::Scalar(0, 0, 255), cv::FILLED);
-    cv::putText(img, std::to_string(cnt), cv::Point(result.first, result.second), cv::FONT_HERSHEY_DUPLEX, 1.0, CV_RGB(255, 0, 0), 2);
-    cnt++;
-  }
+  Show(Renderer().RenderLabels(location_ids, origin));
+}
+
+/**
+ * Show: Show an image in the TrojanMap window
+ * 
+ * @param  {cv::Mat} img : the image
+ */
+void MapUI::Show(const cv::Mat &img) {
   cv::startWindowThread();
   cv::imshow("TrojanMap", img);
   cv::waitKey(1);
 }
 
+// Renders animation frames on worker threads and hands them to a sink in
+// order on the thread that pushes them. At most `capacity` frames are in
+// flight, so a long animation never holds more than that many images. A
+// path equal to the previous one is not drawn again; its frame is repeated.
+class FramePipeline {
+ public:
+  FramePipeline(const cv::Mat &base, int threads, int capacity,
+                std::function<void(const cv::Mat &)> sink)
+      : base(base), capacity(std::max(1, capacity)), sink(std::move(sink)) {
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    for (int i = 0; threads > 1 && i < threads; i++) {
+      workers.emplace_back([this]() { Work(); });
+    }
+  }
+
+  ~FramePipeline() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    job_ready.notify_all();
+    for (auto &t : workers) t.join();
+  }
+
+  void Push(std::vector<cv::Point> path) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (pushed_any && path == last_path) {
+      if (in_flight.empty()) {
+        // last_frame only changes in Drain, on this thread, so it can be
+        // read without the lock; the sink must not run under it.
+        lock.unlock();
+        sink(last_frame);
+      } else {
+        in_flight.back().copies++;
+      }
+      return;
+    }
+    pushed_any = true;
+    last_path = path;
+    long long seq = first_seq + in_flight.size();
+    in_flight.emplace_back();
+    if (workers.empty()) {
+      cv::Mat img = TakeBuffer();
+      lock.unlock();
+      Render(path, img);
+      lock.lock();
+      Complete(seq, std::move(img));
+    } else {
+      jobs.push_back({seq, std::move(path)});
+      job_ready.notify_one();
+    }
+    Drain(lock, capacity - 1);
+  }
+
+  // Write out every pushed frame.
+  void Finish() {
+    std::unique_lock<std::mutex> lock(mutex);
+    Drain(lock, 0);
+  }
+
+  // The last frame handed to the sink.
+  const cv::Mat &LastFrame() const { return last_frame; }
+
+ private:
+  class Frame {
+   public:
+    cv::Mat img;
+    int copies = 1;
+    bool ready = false;
+  };
+
+  void Render(const std::vector<cv::Point> &path, cv::Mat &img) const {
+    base.copyTo(img);
+    MapRenderer::DrawPath(img, path);
+  }
+
+  cv::Mat TakeBuffer() {
+    if (spare.empty()) return cv::Mat();
+    cv::Mat img = std::move(spare.back());
+    spare.pop_back();
+    return img;
+  }
+
+  void Complete(long long seq, cv::Mat img) {
+    Frame &frame = in_flight[seq - first_seq];
+    frame.img = std::move(img);
+    frame.ready = true;
+    frame_ready.notify_all();
+  }
+
+  // Write finished frames in order until at most `keep` are in flight.
+  void Drain(std::unique_lock<std::mutex> &lock, size_t keep) {
+    while (in_flight.size() > keep ||
+           (!in_flight.empty() && in_flight.front().ready)) {
+      frame_ready.wait(lock, [this]() { return in_flight.front().ready; });
+      Frame frame = std::move(in_flight.front());
+      in_flight.pop_front();
+      first_seq++;
+      lock.unlock();
+      for (int i = 0; i < frame.copies; i++) sink(frame.img);
+      lock.lock();
+      if (!last_frame.empty()) spare.push_back(std::move(last_frame));
+      last_frame = std::move(frame.img);
+    }
+  }
+
+  void Work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      job_ready.wait(lock, [this]() { return stopping || !jobs.empty(); });
+      if (jobs.empty()) return;
+      auto job = std::move(jobs.front());
+      jobs.pop_front();
+      cv::Mat img = TakeBuffer();
+      lock.unlock();
+      Render(job.second, img);
+      lock.lock();
+      Complete(job.first, std::move(img));
+    }
+  }
+
+  const cv::Mat &base;
+  size_t capacity;
+  std::function<void(const cv::Mat &)> sink;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable job_ready, frame_ready;
+  std::deque<std::pair<long long, std::vector<cv::Point>>> jobs;
+  std::deque<Frame> in_flight;  // frame first_seq onwards, not yet written
+  long long first_seq = 0;
+  std::vector<cv::Mat> spare;  // written frames whose buffers can be reused
+  std::vector<cv::Point> last_path;
+  cv::Mat last_frame;
+  bool pushed_any = false;
+  bool stopping = false;
+};
+
 /**
  * CreateAnimation: Create the videos of the progress to get the path
  * 
  * @param  {std::vector<std::vector<std::string>>} path_progress : the progress to get the path
+ * @param  {std::string} filename                   : output file in src/lib
+ * @param  {AnimationOptions} options               : threads, queue, headless
+ */
+void MapUI::CreateAnimation(std::vector<std::vector<std::string>> path_progress, std::string filename,
+                            const AnimationOptions &options){
+  cv::VideoWriter video("src/lib/" + filename, cv::VideoWriter::fourcc('M','J','P','G'), options.fps, cv::Size(viewport.width, viewport.height));
+  {
+    FramePipeline frames(BaseImage(), options.threads, options.queue_size,
+                         [&](const cv::Mat &img) { WriteFrame(video, img, options); });
+    for (auto &location_ids : path_progress) frames.Push(GetPixels(location_ids));
+    frames.Finish();
+    for (int i = 0 ; i < 5 && !frames.LastFrame().empty(); i++)
+      video.write(frames.LastFrame());
+  }
+	video.release();
+}
+
+/**
+ * CreateAnimation: Create the video of a recorded TSP progress. Frames are
+ * rebuilt from the recorded moves one at a time and rasterised on worker
+ * threads, with only a bounded number of them in memory at once.
+ * 
+ * @param  {TSPProgress} progress                   : the recorded progress
+ * @param  {std::vector<std::string>} location_ids  : the stops the matrix indices refer to
+ * @param  {std::string} filename                   : output file in src/lib
+ * @param  {AnimationOptions} options               : threads, queue, headless
+ */
+void MapUI::CreateAnimation(const TSPProgress &progress,
+                            const std::vector<std::string> &location_ids,
+                            std::string filename,
+                            const AnimationOptions &options) {
+  cv::VideoWriter video("src/lib/" + filename, cv::VideoWriter::fourcc('M','J','P','G'), options.fps, cv::Size(viewport.width, viewport.height));
+  // Unknown stops are left out of every frame.
+  std::vector<cv::Point> stops;
+  std::vector<bool> known;
+  stops.reserve(location_ids.size());
+  for (auto &id : location_ids) {
+    stops.push_back(GetPixel(id));
+    known.push_back(map.id_to_index.count(id) > 0);
+  }
+  FramePipeline frames(BaseImage(), options.threads, options.queue_size,
+                       [&](const cv::Mat &img) { WriteFrame(video, img, options); });
+  progress.Replay([&](const std::vector<int> &tour) {
+    std::vector<cv::Point> path;
+    path.reserve(tour.size());
+    for (int i : tour) {
+      if (known[i]) path.push_back(stops[i]);
+    }
+    frames.Push(std::move(path));
+  });
+  frames.Finish();
+  if (frames.LastFrame().empty()) return;
+  for (int i = 0 ; i < 5; i++)
+    video.write(frames.LastFrame());
+  video.release();
+}
+
+/**
+ * WriteFrame: Append a frame to the video and, unless headless, show it
+ * 
+ * @param  {cv::VideoWriter} video      : the video
+ * @param  {cv::Mat} img                : the frame
+ * @param  {AnimationOptions} options   : whether to show it
+ */
+void MapUI::WriteFrame(cv::VideoWriter &video, const cv::Mat &img,
+                       const AnimationOptions &options) {
+  video.write(img);
+  if (!options.headless) Show(img);
+}
+
+/**
+ * DrawPathFrame: Draw a path on a fresh copy of the map
+ * 
+ * @param  {std::vector<std::string>} location_ids : the path
+ * @return {cv::Mat}                                : the image
  */
-void MapUI::CreateAnimation(std::vector<std::vector<std::string>> path_progress, std::string filename){
-  cv::VideoWriter video("src/lib/" + filename, cv::VideoWriter::fourcc('M','J','P','G'), 2, cv::Size(1280,900));
+cv::Mat MapUI::DrawPathFrame(const std::vector<std::string> &location_ids) {
   cv::Mat img;
-  for(auto location_ids: path_progress) {
-    std::string image_path = cv::samples::findFile("src/lib/map.png");
-    img = cv::imread(image_path, cv::IMREAD_COLOR);
-    // cv::resize(img, img, cv::Size(img.cols, img.rows));
-    auto start = GetPlotLocation(map.data[location_ids[0]].lat, map.data[location_ids[0]].lon);
-    cv::circle(img, cv::Point(int(start.first), int(start.second)), DOT_SIZE,
-              cv::Scalar(0, 0, 255), cv::FILLED);
-    for (auto i = 1; i < int(location_ids.size()); i++) {
-      auto start = GetPlotLocation(map.data[location_ids[i - 1]].lat, map.data[location_ids[i - 1]].lon);
-      auto end = GetPlotLocation(map.data[location_ids[i]].lat, map.data[location_ids[i]].lon);
-      cv::circle(img, cv::Point(int(end.first), int(end.second)), DOT_SIZE,
-                cv::Scalar(0, 0, 255), cv::FILLED);
-      cv::line(img, cv::Point(int(start.first), int(start.second)),
-              cv::Point(int(end.first), int(end.second)), cv::Scalar(0, 255, 0),
-              LINE_WIDTH);
+  DrawPathFrame(location_ids, img);
+  return img;
+}
+
+/**
+ * DrawPathFrame: Draw a path into img, reusing its buffer when it already
+ * has the size of the map
+ * 
+ * @param  {std::vector<std::string>} location_ids : the path
+ * @param  {cv::Mat} img                            : the image to draw into
+ */
+void MapUI::DrawPathFrame(const std::vector<std::string> &location_ids,
+                          cv::Mat &img) {
+  BaseImage().copyTo(img);
+  MapRenderer::DrawPath(img, GetPixels(location_ids));
+}
+
+/**
+ * Renderer: The renderer for the current viewport. map.png is decoded once
+ * and shared by the renderers of every viewport.
+ * 
+ * @return {MapRenderer}  : the renderer
+ */
+const MapRenderer &MapUI::Renderer() {
+  if (!renderer) {
+    if (map_image.empty()) {
+      std::string image_path = cv::samples::findFile("src/lib/map.png");
+      map_image = cv::imread(image_path, cv::IMREAD_COLOR);
     }
-    video.write(img);
-    cv::startWindowThread();
-    cv::imshow("TrojanMap", img);
-    cv::waitKey(1);
+    renderer.reset(new MapRenderer(map, viewport, map_image));
   }
-  for (int i = 0 ; i < 5; i++)
-    video.write(img);
-	video.release();
+  return *renderer;
 }
+
+/**
+ * SetViewport: Change the area drawn and the image size. The renderer is
+ * rebuilt on its next use.
+ * 
+ * @param  {Viewport} v : the new viewport
+ */
+void MapUI::SetViewport(const Viewport &v) {
+  if (v == viewport) return;
+  viewport = v;
+  renderer.reset();
+}
+
 /**
  * GetPlotLocation: Transform the location to the position on the map
  * 
@@ -719,13 +851,7 @@ void MapUI::CreateAnimation(std::vector<std::vector<std::string>> path_progress,
  * @return {std::pair<double, double>}  : position on the map
  */
 std::pair<double, double> MapUI::GetPlotLocation(double lat, double lon) {
-  std::pair<double, double> bottomLeft(33.9990000, -118.3210000);
-  std::pair<double, double> upperRight(34.0410000, -118.2490000);
-  double h = upperRight.first - bottomLeft.first;
-  double w = upperRight.second - bottomLeft.second;
-  std::pair<double, double> result((lon - bottomLeft.second) / w * 1280,
-                                   (1 - (lat - bottomLeft.first) / h) * 900);
-  return result;
+  return Renderer().GetPlotLocation(lat, lon);
 }
 
 #ifdef NCURSES
@@ -1,7 +1,5 @@
 #ifndef MapUI_H
 #define MapUI_H
-#define DOT_SIZE 5
-#define LINE_WIDTH 3
 
 // #define NCURSES
 #ifdef NCURSES
@@ -13,7 +11,9 @@
 #endif
 
 #include <iostream>
+#include <memory>
 #include "trojanmap.h"
+#include "maprenderer.h"
 #include <time.h>
 #include "opencv2/core.hpp"
 #include "opencv2/highgui.hpp"
@@ -21,9 +21,25 @@
 #include "opencv2/imgproc.hpp"
 #include "opencv2/videoio.hpp"
 
+// How CreateAnimation renders and writes its frames.
+class AnimationOptions {
+ public:
+  bool headless = false;  // only write the video, never call imshow
+  int threads = 0;        // rasterising threads, 0 = one per hardware thread
+  int queue_size = 8;     // frames rendered ahead of the video writer
+  double fps = 2;
+};
+
 class MapUI {
  private:
   TrojanMap map;
+  Viewport viewport;
+  // map.png decoded once, and the renderer for the current viewport.
+  cv::Mat map_image;
+  std::unique_ptr<MapRenderer> renderer;
+
+  // Show an image in the TrojanMap window.
+  void Show(const cv::Mat &img);
 
  public:
   // Create the menu.
@@ -59,7 +75,46 @@ class MapUI {
   void PlotPointsLabel(std::vector<std::string> &location_ids, std::string origin);
 
   // Create the videos of the progress to get the path
-  void CreateAnimation(std::vector<std::vector<std::string>>, std::string);
+  void CreateAnimation(std::vector<std::vector<std::string>>, std::string,
+                       const AnimationOptions &options = AnimationOptions());
+
+  // Create the video from a recorded progress over the given stops, drawing
+  // each frame as it is replayed.
+  void CreateAnimation(const TSPProgress &progress,
+                       const std::vector<std::string> &location_ids,
+                       std::string filename,
+                       const AnimationOptions &options = AnimationOptions());
+
+  // Append one animation frame to video, showing it unless headless.
+  void WriteFrame(cv::VideoWriter &video, const cv::Mat &img,
+                  const AnimationOptions &options);
+
+  // Draw a path on a fresh copy of the map.
+  cv::Mat DrawPathFrame(const std::vector<std::string> &location_ids);
+  // Same, drawing into img so one buffer can be reused across frames.
+  void DrawPathFrame(const std::vector<std::string> &location_ids,
+                     cv::Mat &img);
+
+  // The offscreen renderer for the current viewport, built on first use.
+  // Its Render methods need no display and may run on many threads.
+  const MapRenderer &Renderer();
+
+  // The map image and the road layer PlotMap shows. Plots draw on copies.
+  const cv::Mat &BaseImage() { return Renderer().BaseImage(); }
+  const cv::Mat &RoadLayer() { return Renderer().RoadLayer(); }
+
+  // Change the area drawn and the image size; defaults to map.png.
+  void SetViewport(const Viewport &v);
+  const Viewport &GetViewport() const { return viewport; }
+
+  // Pixel positions of all nodes by node index, cached per viewport, and of
+  // one location.
+  const std::vector<cv::Point> &NodePixels() { return Renderer().NodePixels(); }
+  cv::Point GetPixel(const std::string &id) { return Renderer().GetPixel(id); }
+  // Pixel positions of the known locations; unknown ids are skipped.
+  std::vector<cv::Point> GetPixels(const std::vector<std::string> &ids) {
+    return Renderer().GetPixels(ids);
+  }
 
   // Transform the location to the position on the map
   std::pair<double, double> GetPlotLocation(double lat, double lon);
@@ -1,5 +1,60 @@
 #include "trojanmap.h"
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <set>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * HaversineMiles: Same great-circle formula as CalculateDistance, on raw
+ * coordinates so it can run without touching `data`.
+ */
+static double HaversineMiles(double a_lat, double a_lon, double b_lat,
+                             double b_lon) {
+  double dlon = (b_lon - a_lon) * M_PI / 180.0;
+  double dlat = (b_lat - a_lat) * M_PI / 180.0;
+  double p = pow(sin(dlat / 2), 2.0) + cos(a_lat * M_PI / 180.0) *
+                                           cos(b_lat * M_PI / 180.0) *
+                                           pow(sin(dlon / 2), 2.0);
+  double c = 2 * asin(std::min(1.0, sqrt(p)));
+  return c * 3961;
+}
+
+/**
+ * ParallelFor: Call fn(i, worker) for every i in [0, count) using up to
+ * num_threads threads (0 = one per hardware thread). Items are handed out
+ * one at a time, so uneven items still balance.
+ */
+static void ParallelFor(size_t count, int num_threads,
+                        const std::function<void(size_t, int)> &fn) {
+  if (num_threads <= 0) num_threads = std::thread::hardware_concurrency();
+  if (num_threads <= 0) num_threads = 1;
+  if (size_t(num_threads) > count) num_threads = int(count);
+  if (num_threads <= 1) {
+    for (size_t i = 0; i < count; i++) fn(i, 0);
+    return;
+  }
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (int w = 0; w < num_threads; w++) {
+    workers.emplace_back([&, w]() {
+      for (size_t i = next++; i < count; i = next++) fn(i, w);
+    });
+  }
+  for (auto &t : workers) t.join();
+}
+
 //-----------------------------------------------------
 // TODO: Student should implement the following:
 //-----------------------------------------------------
@@ -285,12 +340,16 @@ double TrojanMap::CalculatePathLength(const std::vector<std::string> &path) {
  *
  * @param  {std::string} location1_name     : start
  * @param  {std::string} location2_name     : goal
+ * @param  {QueryContext*} ctx              : optional deadline; empty path on timeout
  * @return {std::vector<std::string>}       : path
  */
 std::vector<std::string> TrojanMap::CalculateShortestPath_Dijkstra(
-    std::string location1_name, std::string location2_name) {
+    std::string location1_name, std::string location2_name,
+    QueryContext *ctx) {
+  if (ctx) ctx->status = QueryStatus::kComplete;
   std::string start = GetID(location1_name);
   std::string end = GetID(location2_name);
+  if (!IsReachable(start, end)) return {};
   std::map<std::string, std::vector<std::string>> visited;
   visited[start].push_back(start);
   std::priority_queue< std::pair<double, std::string>, 
@@ -308,6 +367,10 @@ std::vector<std::string> TrojanMap::CalculateShortestPath_Dijkstra(
   q.push(p1);
 
   while(!q.empty()){
+    if (ctx && ctx->Poll()) {
+      ctx->status = QueryStatus::kTimeout;
+      return {};
+    }
     std::string s1 = q.top().second;
     q.pop();
     for (auto s2: GetNeighborIDs(s1)){
@@ -336,19 +399,23 @@ std::vector<std::string> TrojanMap::CalculateShortestPath_Dijkstra(
  *
  * @param  {std::string} location1_name     : start
  * @param  {std::string} location2_name     : goal
+ * @param  {QueryContext*} ctx              : optional deadline; empty path on timeout
  * @return {std::vector<std::string>}       : path
  */
 std::vector<std::string> TrojanMap::CalculateShortestPath_Bellman_Ford(
-    std::string location1_name, std::string location2_name) {
+    std::string location1_name, std::string location2_name,
+    QueryContext *ctx) {
+  if (ctx) ctx->status = QueryStatus::kComplete;
   std::vector<std::string> path;
+  std::string start = GetID(location1_name);
+  std::string end = GetID(location2_name);
+  if (!IsReachable(start, end)) return path;
   std::map<std::string, std::pair<std::string, double>> round;
   std::unordered_map<std::string, Node>::iterator iter;
   for (iter = data.begin(); iter != data.end(); ++iter){
     //std::pair<std::string, double> temp;
     round[iter -> first] =  {"", INT_MAX};
   }
-  std::string start = GetID(location1_name);
-  std::string end = GetID(location2_name);
   round[start] = {"START", 0};
   bool relax = true;
   for(int i =0; i< data.size(); i++){
@@ -358,7 +425,10 @@ std::vector<std::string> TrojanMap::CalculateShortestPath_Bellman_Ford(
     }
     relax = false;
     for (iter = data.begin(); iter != data.end(); ++iter){
-
+        if (ctx && ctx->Poll()) {
+          ctx->status = QueryStatus::kTimeout;
+          return {};
+        }
         std::vector<std::string> neighbor = GetNeighborIDs(iter->first);
         for(std::string s: neighbor){
             if(round[iter->first].second > round[s].second + CalculateDistance(s,iter->first)){
@@ -398,6 +468,8 @@ std::vector<std::string> TrojanMap::CalculateShortestPath_Bellman_Ford(
  * path which visit all the places and back to the start point.
  *
  * @param  {std::vector<std::string>} input : a list of locations needs to visit
+ * @param  {QueryContext*} ctx              : optional deadline; on timeout the
+ * result is empty
  * @return {std::pair<double, std::vector<std::vector<std::string>>} : a pair of
  * total distance and the all the progress to get final path
  */
@@ -406,7 +478,9 @@ void TrojanMap::TravelingTrojan_BF(std::string start,
                         std::vector<std::string> cur_path, 
                         double &min_cost,
                         std::vector<std::string> &min_path,
-                        std::vector<std::vector<std::string>> &record_list){
+                        std::vector<std::vector<std::string>> &record_list,
+                        QueryContext *ctx){
+    if (ctx && ctx->Poll()) return;
     if (cur_path.size() == location_ids.size()){
       cur_path.push_back(start);
       double cost = CalculatePathLength(cur_path);
@@ -424,13 +498,15 @@ void TrojanMap::TravelingTrojan_BF(std::string start,
       }
 
       cur_path.push_back(location_ids[i]);
-      TravelingTrojan_BF(start, location_ids,cur_path, min_cost, min_path,record_list);
+      TravelingTrojan_BF(start, location_ids,cur_path, min_cost, min_path,record_list,ctx);
       cur_path.pop_back();
     }
 }
 
 std::pair<double, std::vector<std::vector<std::string>>>
-TrojanMap::TravelingTrojan_Brute_force(std::vector<std::string> location_ids) {
+TrojanMap::TravelingTrojan_Brute_force(std::vector<std::string> location_ids,
+                                       QueryContext *ctx) {
+  if (ctx) ctx->status = QueryStatus::kComplete;
   //递归法
   /*
   std::vector<std::vector<std::string>> order_list;
@@ -510,7 +586,11 @@ TrojanMap::TravelingTrojan_Brute_force(std::vector<std::string> location_ids) {
   std::vector<std::string> cur_path = {location_ids[0]};
   std::vector<std::string> min_path;
   double min_cost = INT_MAX;
-  TravelingTrojan_BF(current_id,location_ids,cur_path,min_cost,min_path,order_list);
+  TravelingTrojan_BF(current_id,location_ids,cur_path,min_cost,min_path,order_list,ctx);
+  if (ctx && ctx->Stopped()) {
+    ctx->status = QueryStatus::kTimeout;
+    return {0, {}};
+  }
   std::pair<double, std::vector<std::vector<std::string>>> records(min_cost,order_list);
   return records;
 
@@ -522,7 +602,9 @@ void TrojanMap::TravelingTrojan_BT(std::string start,
                         std::vector<std::string> cur_path, 
                         double &min_cost,
                         std::vector<std::string> &min_path,
-                        std::vector<std::vector<std::string>> &record_list){
+                        std::vector<std::vector<std::string>> &record_list,
+                        QueryContext *ctx){
+    if (ctx && ctx->Poll()) return;
     if (cur_path.size() ==location_ids.size()){
       cur_path.push_back(start);
       double cost = CalculatePathLength(cur_path);
@@ -543,13 +625,15 @@ void TrojanMap::TravelingTrojan_BT(std::string start,
       }
 
       cur_path.push_back(location_ids[i]);
-      TravelingTrojan_BT(start, location_ids,cur_path, min_cost, min_path,record_list);
+      TravelingTrojan_BT(start, location_ids,cur_path, min_cost, min_path,record_list,ctx);
       cur_path.pop_back();
     }
 }
 
 std::pair<double, std::vector<std::vector<std::string>>>
-TrojanMap::TravelingTrojan_Backtracking(std::vector<std::string> location_ids) {
+TrojanMap::TravelingTrojan_Backtracking(std::vector<std::string> location_ids,
+                                        QueryContext *ctx) {
+  if (ctx) ctx->status = QueryStatus::kComplete;
   std::vector<std::vector<std::string>> order_list;
   if(location_ids.size() == 0){
     std::pair<double, std::vector<std::vector<std::string>>> records(0,order_list);
@@ -568,304 +652,2670 @@ TrojanMap::TravelingTrojan_Backtracking(std::vector<std::string> location_ids) {
   std::vector<std::string> min_path;
   
   double min_cost = INT_MAX;
-  TravelingTrojan_BT(current_id,location_ids,cur_path,min_cost,min_path,order_list);
+  TravelingTrojan_BT(current_id,location_ids,cur_path,min_cost,min_path,order_list,ctx);
+  if (ctx && ctx->Stopped()) {
+    ctx->status = QueryStatus::kTimeout;
+    return {0, {}};
+  }
   std::pair<double, std::vector<std::vector<std::string>>> records(min_cost,order_list);
   return records;
 }
 
-std::pair<double, std::vector<std::vector<std::string>>>
-TrojanMap::TravelingTrojan_2opt(std::vector<std::string> location_ids) {
-  
-  std::vector<std::vector<std::string>> order_list;
-  std::vector<std::string> min_path = location_ids;
-  min_path.push_back(location_ids[0]);
-  double min_cost = CalculatePathLength(min_path);
-  min_path.pop_back();
-  bool improve = true;
-  while (improve){
-    improve = false;
-    for(int i = 1; i< min_path.size()-2;i++){
-      for(int j = i+1; j< min_path.size(); j++){
-        std::vector<std::string> new_path;
-        for(int m = 0; m < i; m++){
-          new_path.push_back(min_path[m]);
-        }
-        for(int m = j; m >= i; m--){
-          new_path.push_back(min_path[m]);
-        }
-        for(int m = j+1; m<min_path.size();m++){
-          new_path.push_back(min_path[m]);
-        }
-        new_path.push_back(min_path[0]);
-        double cost = CalculatePathLength(new_path);
-        if(cost < min_cost){
-          min_cost = cost;
-          min_path = new_path;
-          order_list.push_back(new_path);
-          min_path.pop_back();
-          improve = true;
-        }
+// The k nearest other stops of every stop, nearest first.
+static std::vector<std::vector<int>> NearestCandidates(
+    const DistanceMatrix &dist, int k) {
+  int n = dist.n;
+  k = std::max(0, std::min(k, n - 1));
+  std::vector<std::vector<int>> candidates(n);
+  std::vector<int> others;
+  for (int c = 0; c < n; c++) {
+    others.clear();
+    for (int o = 0; o < n; o++) {
+      if (o != c) others.push_back(o);
+    }
+    std::partial_sort(others.begin(), others.begin() + k, others.end(),
+                      [&](int a, int b) { return dist(c, a) < dist(c, b); });
+    candidates[c].assign(others.begin(), others.begin() + k);
+  }
+  return candidates;
+}
 
+void TSPProgress::Reset(const std::vector<int> &tour) {
+  base = current = tour;
+  moves.clear();
+  snapshots.clear();
+  stored = 0;
+  frame_marks = 0;
+  dropped_frames = 0;
+}
 
-      }
-    }
+void TSPProgress::Reverse(int i, int len) {
+  if (len < 2) return;
+  Apply(current, i, len);
+  moves.push_back({i, len});
+  stored += 2;
+  Fold();
+}
+
+void TSPProgress::Snapshot(const std::vector<int> &tour) {
+  current = tour;
+  moves.push_back({kSnapshot, 0});
+  snapshots.push_back(tour);
+  stored += 2 + tour.size();
+  Fold();
+}
+
+void TSPProgress::Frame() {
+  moves.push_back({kFrame, 0});
+  stored += 2;
+  frame_marks++;
+  if (!subscribers.empty()) {
+    std::vector<int> closed = Closed(current);
+    for (auto &fn : subscribers) fn(closed);
   }
+  Fold();
+}
 
-  std::pair<double, std::vector<std::vector<std::string>>> records(min_cost,order_list);
-  return records;
+void TSPProgress::Subscribe(
+    std::function<void(const std::vector<int> &)> fn) {
+  subscribers.push_back(std::move(fn));
 }
 
-/**
- * Given CSV filename, it read and parse locations data from CSV file,
- * and return locations vector for topological sort problem.
- *
- * @param  {std::string} locations_filename     : locations_filename
- * @return {std::vector<std::string>}           : locations
- */
-std::vector<std::string> TrojanMap::ReadLocationsFromCSVFile(
-    std::string locations_filename) {
-  std::vector<std::string> location_names_from_csv;
-  std::ifstream inFile(locations_filename, std::ios::in);
-  std::string lineStr;
-  if(inFile.fail()) std::cout << "fail to read the location file." << std::endl;
-  while(getline(inFile, lineStr)){
-    // std::cout << lineStr << std::endl;
-    std::stringstream ss(lineStr);
-    std::string str;
-    // std::vector <std::string> lineArray;
-    while(getline(ss, str, ',')){
-      location_names_from_csv.push_back(str);
+void TSPProgress::Replay(
+    const std::function<void(const std::vector<int> &)> &fn) const {
+  if (base.empty()) return;
+  std::vector<int> tour = base;
+  fn(Closed(tour));
+  size_t snapshot = 0;
+  for (auto &m : moves) {
+    if (m.first == kFrame) {
+      fn(Closed(tour));
+    } else if (m.first == kSnapshot) {
+      tour = snapshots[snapshot++];
+    } else {
+      Apply(tour, m.first, m.second);
     }
-    
   }
-  location_names_from_csv.erase(location_names_from_csv.begin());
-  return location_names_from_csv;
 }
 
+std::vector<int> TSPProgress::Closed(const std::vector<int> &tour) {
+  std::vector<int> closed(tour.size() + 1);
+  auto zero = std::find(tour.begin(), tour.end(), 0);
+  if (zero == tour.end()) zero = tour.begin();
+  std::rotate_copy(tour.begin(), zero, tour.end(), closed.begin());
+  closed.back() = closed.front();
+  return closed;
+}
 
-/**
- * Given CSV filenames, it read and parse dependencise data from CSV file,
- * and return dependencies vector for topological sort problem.
- *
- * @param  {std::string} dependencies_filename     : dependencies_filename
- * @return {std::vector<std::vector<std::string>>} : dependencies
- */
-std::vector<std::vector<std::string>> TrojanMap::ReadDependenciesFromCSVFile(
-    std::string dependencies_filename) {
-  std::vector<std::vector<std::string>> dependencies_from_csv;
-  std::fstream fin;
-  fin.open(dependencies_filename, std::ios::in);
-  std::string lineStr;
-  if(fin.fail()) std::cout << "fail to read the dependency file." << std::endl;
-  while(getline(fin, lineStr)){
-    // std::cout << lineStr << std::endl;
-    std::stringstream ss(lineStr);
-    std::string str;
-    std::vector <std::string> lineArray;
-    while(getline(ss, str, ',')){
-      lineArray.push_back(str);
-    }
-  dependencies_from_csv.push_back(lineArray);
-  }
-  dependencies_from_csv.erase(dependencies_from_csv.begin());
-  return dependencies_from_csv;
+// Same in-place cyclic reversal as LocalSearchTour::Reverse.
+void TSPProgress::Apply(std::vector<int> &tour, int i, int len) const {
+  int n = tour.size();
+  int j = (i + len - 1) % n;
+  for (int s = 0; s < len / 2; s++) {
+    std::swap(tour[i], tour[j]);
+    i = i + 1 == n ? 0 : i + 1;
+    j = j == 0 ? n - 1 : j - 1;
+  }
 }
 
-/**
- * DeliveringTrojan: Given a vector of location names, it should return a
- * sorting of nodes that satisfies the given dependencies. If there is no way to
- * do it, return a empty vector.
- *
- * @param  {std::vector<std::string>} locations                     : locations
- * @param  {std::vector<std::vector<std::string>>} dependencies     :
- * prerequisites
- * @return {std::vector<std::string>} results                       : results
- */
-std::vector<std::string> TrojanMap::DeliveringTrojan(
-    std::vector<std::string> &locations,
-    std::vector<std::vector<std::string>> &dependencies) {
-      std::map<std::string, int> visited;
-      std::map<std::string, int> indegree;
-      std::vector<std::string> result;
+// Move whole frames, oldest first, into base until under capacity, so that
+// base is always a frame boundary. The frame in progress is never folded:
+// once its moves take twice the space of a tour they are replaced by a
+// snapshot of the current one, which keeps it bounded without losing it.
+void TSPProgress::Fold() {
+  while (stored > capacity && !moves.empty()) {
+    if (frame_marks == 0) {
+      if (stored < 2 * (2 + current.size())) return;
+      moves.assign(1, {kSnapshot, 0});
+      snapshots.assign(1, current);
+      stored = 2 + current.size();
+      return;
+    }
+    while (true) {
+      auto m = moves.front();
+      moves.pop_front();
+      stored -= 2;
+      if (m.first == kFrame) {
+        frame_marks--;
+        dropped_frames++;
+        break;
+      } else if (m.first == kSnapshot) {
+        base = std::move(snapshots.front());
+        snapshots.pop_front();
+        stored -= base.size();
+      } else {
+        Apply(base, m.first, m.second);
+      }
+    }
+  }
+}
+
+// A tour under local search. Cities live in a flat array with their
+// positions, so a move is scored from the distance matrix in O(1) and
+// applied by reversing a slice of the array in place. Each city only tries
+// moves towards its k nearest neighbors, and cities whose neighborhood has
+// not changed since they last failed to improve are skipped (don't-look
+// bits). Distances are assumed symmetric.
+class LocalSearchTour {
+ public:
+  LocalSearchTour(const DistanceMatrix &d, const std::vector<int> &order,
+                  int k)
+      : dist(d),
+        n(d.n),
+        tour(order),
+        pos(d.n),
+        candidates(NearestCandidates(d, k)),
+        dont_look(d.n, 0) {
+    for (int i = 0; i < n; i++) pos[tour[i]] = i;
+  };
+
+  const DistanceMatrix &dist;
+  int n;
+  std::vector<int> tour;  // cyclic order of the cities
+  std::vector<int> pos;   // pos[city] = index in tour
+  std::vector<std::vector<int>> candidates;
+  std::vector<char> dont_look;
+  std::deque<int> queue;  // cities whose don't-look bit is off
+
+  int Next(int c) const { return tour[pos[c] + 1 == n ? 0 : pos[c] + 1]; }
+  int Prev(int c) const { return tour[pos[c] == 0 ? n - 1 : pos[c] - 1]; }
+
+  double Length() const {
+    double sum = 0;
+    for (int i = 0; i < n; i++) sum += dist(tour[i], tour[(i + 1) % n]);
+    return sum;
+  }
 
-      for (auto dependency :dependencies){
-        for (std::vector<std::string>::iterator iter = ++dependency.begin(); iter != dependency.end(); ++iter){
-          if (indegree[*iter] ==0) indegree[*iter] = 1;
-          else indegree[*iter] ++;
+  // Reverse the cyclic slice from position i forward to position j. The
+  // shorter of the slice and its complement is flipped; as a cycle both give
+  // the same tour.
+  void Reverse(int i, int j) {
+    int len = (j - i + n) % n + 1;
+    if (2 * len > n) {
+      int ni = (j + 1) % n;
+      j = (i - 1 + n) % n;
+      i = ni;
+      len = n - len;
+    }
+    if (recorder) recorder->Reverse(i, len);
+    for (int s = 0; s < len / 2; s++) {
+      int a = tour[i], b = tour[j];
+      tour[i] = b;
+      pos[b] = i;
+      tour[j] = a;
+      pos[a] = j;
+      i = i + 1 == n ? 0 : i + 1;
+      j = j == 0 ? n - 1 : j - 1;
+    }
+  }
 
+  // Replace edges (a, b) and (c, d) by (a, c) and (b, d), where b follows a
+  // and d follows c in the same direction of travel; d is implied by c.
+  void Move2(int a, int b, int c) {
+    if (Next(a) == b) {
+      Reverse(pos[b], pos[c]);  // a b ... c d  ->  a c ... b d
+    } else {
+      Reverse(pos[c], pos[b]);  // d c ... b a  ->  d b ... c a
+    }
+  }
+
+  void Wake(int c) {
+    if (dont_look[c]) {
+      dont_look[c] = 0;
+      queue.push_back(c);
+    }
+  }
+
+  // Look for an improving 2-opt move that replaces an edge at city a with an
+  // edge to one of its candidates. Applies the first one found.
+  bool TwoOptMove(int a) {
+    for (int dir = 0; dir < 2; dir++) {
+      int b = dir == 0 ? Next(a) : Prev(a);
+      double d_ab = dist(a, b);
+      for (int c : candidates[a]) {
+        double d_ac = dist(a, c);
+        if (d_ac >= d_ab) break;  // no gain possible from here on
+        int d = dir == 0 ? Next(c) : Prev(c);
+        if (c == b || d == a) continue;
+        double delta = d_ac + dist(b, d) - d_ab - dist(c, d);
+        if (delta < -1e-10) {
+          Move2(a, b, c);
+          Wake(a);
+          Wake(b);
+          Wake(c);
+          Wake(d);
+          return true;
         }
       }
-      std::priority_queue<std::pair<int, std::string>, 
-                      std::vector<std::pair<int, std::string>>, 
-                      std::greater<std::pair<int, std::string>>> q;
-      for (auto i: locations){
-        if (indegree[i] == 0){
-          std::pair<int, std::string> p1 = {indegree[i], i};
-          visited[i] = 1;
-          q.push(p1);
-        }
-      }
+    }
+    return false;
+  }
 
-      while (!q.empty()){
-        std::string s1 = q.top().second;
-        q.pop();
-        if (std::find(result.begin(), result.end(), s1) == result.end()){
-          result.push_back(s1);
+  // Look for an improving Or-opt move: take a segment of 1 to 3 cities
+  // that starts or ends at city a and reinsert it, in either orientation,
+  // next to one of the candidates of its end cities. Reinserting reversed is
+  // the segment-insertion case of 3-opt. Applies the first one found.
+  bool OrOptMove(int a) {
+    for (int len = 1; len <= 3 && len + 2 < n; len++) {
+      for (int side = 0; side < 2; side++) {
+        int s1 = a, s2 = a;
+        for (int i = 1; i < len; i++) {
+          if (side == 0) {
+            s2 = Next(s2);
+          } else {
+            s1 = Prev(s1);
+          }
         }
-        visited[s1] = 1;
-        for (auto n:dependencies){
-          for (std::vector<std::string>::iterator iter2 = n.begin(); iter2 != n.end(); ++iter2){
-            if (s1.compare(*iter2) == 0){
-              if (iter2 + 1 != n.end()){
-                indegree[*(iter2 + 1)] --;
-                // std::cout << *iter2 << std::endl;
+        int p = Prev(s1), nx = Next(s2);
+        double removed = dist(p, s1) + dist(s2, nx) - dist(p, nx);
+        if (removed <= 1e-10) continue;
+        for (int end = 0; end < 2; end++) {
+          int s = end == 0 ? s1 : s2;
+          for (int c : candidates[s]) {
+            if (dist(s, c) >= removed) break;
+            if (InSegment(c, s1, len)) continue;
+            for (int e_dir = 0; e_dir < 2; e_dir++) {
+              // Insertion edge (x, y) with y following x.
+              int x = e_dir == 0 ? c : Prev(c);
+              int y = e_dir == 0 ? Next(c) : c;
+              if (InSegment(x, s1, len) || InSegment(y, s1, len) || y == p) {
+                continue;
               }
+              double kept = dist(x, s1) + dist(s2, y);
+              double flipped = dist(x, s2) + dist(s1, y);
+              double delta = std::min(kept, flipped) - dist(x, y) - removed;
+              if (delta >= -1e-10) continue;
+              // p s1..s2 nx ... x y  ->  p x ... nx s2..s1 y
+              Move2(p, s1, x);
+              //                      ->  p nx ... x s2..s1 y
+              Move2(p, x, nx);
+              if (kept < flipped && s1 != s2) Move2(x, s2, s1);
+              Wake(p);
+              Wake(nx);
+              Wake(x);
+              Wake(y);
+              Wake(s1);
+              Wake(s2);
+              return true;
             }
           }
         }
-        for (auto m: locations){
-          if (indegree[m] == 0 && visited[m] == 0){
-            std::pair<int, std::string> p2 = {indegree[m], m};
-            q.push(p2);
+      }
+    }
+    return false;
+  }
+
+  // Whether city c is one of the len cities starting at s1.
+  bool InSegment(int c, int s1, int len) const {
+    return (pos[c] - pos[s1] + n) % n < len;
+  }
+
+  // Run the given move until no city can improve. on_sweep is called after
+  // every sweep of the queue that changed the tour.
+  void Optimize(const std::function<bool(int)> &move,
+                const std::function<void()> &on_sweep) {
+    queue.clear();
+    for (int c : tour) {
+      dont_look[c] = 0;
+      queue.push_back(c);
+    }
+    Drain(move, on_sweep);
+  }
+
+  // Like Optimize, but only starting from the cities already in the queue.
+  // Stops early, leaving the queue non-empty, once the deadline passes or
+  // the query context expires.
+  void Drain(const std::function<bool(int)> &move,
+             const std::function<void()> &on_sweep) {
+    int ticks = 0;
+    while (!queue.empty()) {
+      bool improved = false;
+      for (size_t sweep = queue.size(); sweep > 0 && !queue.empty(); sweep--) {
+        if (++ticks % 256 == 0 && OutOfTime()) return;
+        int a = queue.front();
+        queue.pop_front();
+        dont_look[a] = 1;
+        while (move(a)) improved = true;
+      }
+      if (improved && on_sweep) on_sweep();
+    }
+  }
+
+  // Lin-Kernighan step from city t1: break the edge (t1, t2), then
+  // repeatedly add an edge (t2, t3) to a candidate and break (t4, t3) so
+  // that closing with (t4, t1) gives a valid tour. Each step is a 2-opt flip
+  // that leaves (t1, t4) as the edge to break next, so a chain of max_depth
+  // steps is a sequential (max_depth + 1)-opt move. The chain is cut back to
+  // its best closing gain, and undone entirely if that is not positive.
+  bool LinKernighanMove(int t1) {
+    const int max_depth = 5;
+    for (int side = 0; side < 2; side++) {
+      int t2 = side == 0 ? Next(t1) : Prev(t1);
+      double g = dist(t1, t2);  // removed minus added, before closing
+      double best_gain = 1e-10;
+      size_t best_steps = 0;
+      std::vector<std::array<int, 4>> flips;
+      std::vector<std::pair<int, int>> added;
+      for (int depth = 0; depth < max_depth; depth++) {
+        bool forward = Next(t1) == t2;
+        int t3 = -1, t4 = -1;
+        double best_score = -DBL_MAX;
+        for (int c : candidates[t2]) {
+          double g1 = g - dist(t2, c);
+          if (g1 <= 0) break;
+          if (c == t1 || c == Next(t2) || c == Prev(t2)) continue;
+          int d = forward ? Prev(c) : Next(c);
+          bool was_added = false;
+          for (auto &e : added) {
+            if ((e.first == c && e.second == d) ||
+                (e.first == d && e.second == c)) {
+              was_added = true;
+            }
+          }
+          if (was_added) continue;
+          if (g1 + dist(d, c) > best_score) {
+            best_score = g1 + dist(d, c);
+            t3 = c;
+            t4 = d;
           }
         }
-
+        if (t3 < 0) break;
+        Move2(t1, t2, t4);
+        flips.push_back({t1, t2, t4, t3});
+        added.push_back({t2, t3});
+        g = best_score;
+        if (g - dist(t4, t1) > best_gain) {
+          best_gain = g - dist(t4, t1);
+          best_steps = flips.size();
+        }
+        t2 = t4;
       }
-      return result;
-}
+      for (size_t i = flips.size(); i > best_steps; i--) {
+        auto &f = flips[i - 1];
+        Move2(f[0], f[2], f[1]);  // undo: (t1, t4), (t2, t3) -> back
+      }
+      if (best_steps > 0) {
+        for (size_t i = 0; i < best_steps; i++) {
+          for (int c : flips[i]) Wake(c);
+        }
+        return true;
+      }
+    }
+    return false;
+  }
 
+  // Double-bridge kick on a random stretch of the tour: the two segments
+  // after position p swap places. Wakes the cities at the changed edges.
+  void Kick(std::mt19937 &gen) {
+    int window = std::max(1, std::min(50, n / 4));
+    std::uniform_int_distribution<int> pick_pos(0, n - 1), pick_len(1, window);
+    int p = pick_pos(gen), l1 = pick_len(gen), l2 = pick_len(gen);
+    std::vector<int> moved;
+    for (int i = 0; i < l2; i++) moved.push_back(tour[(p + 1 + l1 + i) % n]);
+    for (int i = 0; i < l1; i++) moved.push_back(tour[(p + 1 + i) % n]);
+    for (int i = 0; i < l1 + l2; i++) {
+      int at = (p + 1 + i) % n;
+      tour[at] = moved[i];
+      pos[moved[i]] = at;
+    }
+    Wake(tour[p]);
+    Wake(moved.front());
+    Wake(moved[l2 - 1]);
+    Wake(moved[l2]);
+    Wake(moved.back());
+    Wake(tour[(p + 1 + l1 + l2) % n]);
+  }
 
-/**
- * inSquare: Give a id return whether it is in square or not.
- *
- * @param  {std::string} id            : location id
- * @param  {std::vector<double>} square: four vertexes of the square area
- * @return {bool}                      : in square or not
- */
-bool TrojanMap::inSquare(std::string id, std::vector<double> &square) {
-  if(GetLon(id) < square[0] || GetLon(id) > square[1]){
+  // One iterated local search step: kick, repair with move, and keep the
+  // result only if it is shorter than best, which is then updated.
+  // Otherwise the tour goes back to best_tour.
+  bool Perturb(std::mt19937 &gen, const std::function<bool(int)> &move,
+               double &best, std::vector<int> &best_tour) {
+    Kick(gen);
+    Drain(move, nullptr);
+    double length = Length();
+    if (length < best - 1e-10) {
+      best = length;
+      best_tour = tour;
+      return true;
+    }
+    SetTour(best_tour);
     return false;
   }
 
-  if(square[0] > square[1]){
-    return false;
-  } 
-  if(GetLat(id) > square[2] || GetLat(id) < square[3]){
-    return false;
+  // Replace the tour, leaving every city asleep.
+  void SetTour(const std::vector<int> &order) {
+    tour = order;
+    for (int i = 0; i < n; i++) pos[tour[i]] = i;
+    for (int c : queue) dont_look[c] = 1;
+    queue.clear();
   }
-  if(square[3] > square[2]){
-    return false;
+
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::time_point::max();
+  QueryContext *ctx = nullptr;      // checked along with the deadline
+  TSPProgress *recorder = nullptr;  // receives every reversal when set
+
+  bool OutOfTime() const {
+    return std::chrono::steady_clock::now() > deadline ||
+           (ctx && ctx->Expired());
+  }
+
+  // The tour as a closed path starting and ending at city 0.
+  std::vector<int> ClosedTour() const {
+    std::vector<int> closed;
+    closed.reserve(n + 1);
+    for (int i = 0; i < n; i++) closed.push_back(tour[(pos[0] + i) % n]);
+    closed.push_back(0);
+    return closed;
+  }
+};
+
+// After an improving sweep: end a frame of the recorder if there is one,
+// otherwise keep a copy of the whole tour.
+static void RecordSweep(const LocalSearchTour &search,
+                        std::vector<std::vector<int>> &progress) {
+  if (search.recorder) {
+    search.recorder->Frame();
+  } else {
+    progress.push_back(search.ClosedTour());
   }
-  return true;
 }
 
 /**
- * GetSubgraph: Give four vertexes of the square area, return a list of location
- * ids in the squares
+ * TSP_2opt: 2-opt local search from the given starting order (default: the
+ * input order). Each move is scored by its four changed edges and applied
+ * by an in-place reversal, and only the k nearest neighbors of a city are
+ * tried, so a pass costs O(n k) instead of O(n^3).
  *
- * @param  {std::vector<double>} square         : four vertexes of the square
- * area
- * @return {std::vector<std::string>} subgraph  : list of location ids in the
- * square
+ * @param  {DistanceMatrix} dist      : distances between the stops
+ * @param  {std::vector<int>} initial : starting order, empty for 0..n-1
+ * @param  {int} k                    : candidate neighbors per stop
+ * @param  {TSPProgress*} recorder    : if given, receives the reversals and a
+ * frame per improving sweep instead of the returned progress
+ * @param  {QueryContext*} ctx        : optional deadline; on expiry the current
+ * tour is returned as partial
+ * @return {std::pair<double, std::vector<std::vector<int>>>} : a pair of
+ * total distance and the tour after every improving sweep
  */
-std::vector<std::string> TrojanMap::GetSubgraph(std::vector<double> &square) {
-  // include all the nodes in subgraph
-  std::vector<std::string> subgraph;
-  std::unordered_map<std::string, Node>::iterator iter;
-  for (iter = data.begin(); iter != data.end(); ++iter){
-      if(inSquare(iter -> first, square)){
-          subgraph.push_back(iter -> first);
-      }
-      
+std::pair<double, std::vector<std::vector<int>>> TrojanMap::TSP_2opt(
+    const DistanceMatrix &dist, std::vector<int> initial, int k,
+    TSPProgress *recorder, QueryContext *ctx) {
+  if (ctx) ctx->status = QueryStatus::kComplete;
+  int n = dist.n;
+  if (n == 0) return {0, {}};
+  if (n == 1) return {0, {{0, 0}}};
+  if (initial.empty()) {
+    for (int i = 0; i < n; i++) initial.push_back(i);
   }
+  LocalSearchTour search(dist, initial, k);
+  search.ctx = ctx;
+  std::vector<std::vector<int>> progress;
+  if (recorder) {
+    recorder->Reset(initial);
+    search.recorder = recorder;
+  }
+  search.Optimize([&](int a) { return search.TwoOptMove(a); },
+                  [&]() { RecordSweep(search, progress); });
+  if (ctx && !search.queue.empty()) ctx->status = QueryStatus::kPartial;
+  std::vector<int> tour = search.ClosedTour();
+  if (progress.empty() || progress.back() != tour) progress.push_back(tour);
+  return {TourLength(dist, tour), progress};
+}
 
-  return subgraph;
+/**
+ * TSP_3opt: Local search with 2-opt and Or-opt moves (segments of up to
+ * three stops moved elsewhere, optionally reversed), all scored in O(1) and
+ * driven by the same candidate lists and don't-look bits as TSP_2opt.
+ *
+ * @param  {DistanceMatrix} dist      : distances between the stops
+ * @param  {std::vector<int>} initial : starting order, empty for 0..n-1
+ * @param  {int} k                    : candidate neighbors per stop
+ * @param  {TSPProgress*} recorder    : if given, receives the reversals and a
+ * frame per improving sweep instead of the returned progress
+ * @param  {QueryContext*} ctx        : optional deadline; on expiry the current
+ * tour is returned as partial
+ * @return {std::pair<double, std::vector<std::vector<int>>>} : a pair of
+ * total distance and the tour after every improving sweep
+ */
+std::pair<double, std::vector<std::vector<int>>> TrojanMap::TSP_3opt(
+    const DistanceMatrix &dist, std::vector<int> initial, int k,
+    TSPProgress *recorder, QueryContext *ctx) {
+  if (ctx) ctx->status = QueryStatus::kComplete;
+  int n = dist.n;
+  if (n == 0) return {0, {}};
+  if (n == 1) return {0, {{0, 0}}};
+  if (initial.empty()) {
+    for (int i = 0; i < n; i++) initial.push_back(i);
+  }
+  LocalSearchTour search(dist, initial, k);
+  search.ctx = ctx;
+  std::vector<std::vector<int>> progress;
+  if (recorder) {
+    recorder->Reset(initial);
+    search.recorder = recorder;
+  }
+  search.Optimize(
+      [&](int a) { return search.TwoOptMove(a) || search.OrOptMove(a); },
+      [&]() { RecordSweep(search, progress); });
+  if (ctx && !search.queue.empty()) ctx->status = QueryStatus::kPartial;
+  std::vector<int> tour = search.ClosedTour();
+  if (progress.empty() || progress.back() != tour) progress.push_back(tour);
+  return {TourLength(dist, tour), progress};
 }
 
 /**
- * Cycle Detection: Given four points of the square-shape subgraph, return true
- * if there is a cycle path inside the square, false otherwise.
+ * TravelingTrojan_3opt: Improve a seed tour with 2-opt, Or-opt and segment
+ * insertion moves until none of them shortens the tour.
  *
- * @param {std::vector<std::string>} subgraph: list of location ids in the
- * square
- * @param {std::vector<double>} square: four vertexes of the square area
- * @return {bool}: whether there is a cycle or not
+ * @param  {std::vector<std::string>} input : a list of locations needs to visit
+ * @param  {TourSeed} seed                  : construction of the first tour
+ * @param  {TSPProgress*} progress          : optional compact progress record
+ * @param  {QueryContext*} ctx              : optional deadline or cancellation
+ * @return {std::pair<double, std::vector<std::vector<std::string>>>} : a pair of
+ * total distance and the all the progress to get final path
  */
+std::pair<double, std::vector<std::vector<std::string>>>
+TrojanMap::TravelingTrojan_3opt(std::vector<std::string> location_ids,
+                                TourSeed seed, TSPProgress *progress,
+                                QueryContext *ctx) {
+  DistanceMatrix dist = BuildDistanceMatrix(location_ids);
+  std::vector<int> initial =
+      TSP_InitialTour(dist, seed, GetCoordinates(location_ids));
+  return TourProgressToIds(location_ids,
+                           TSP_3opt(dist, initial, 10, progress, ctx));
+}
 
-bool IfDuHaveCycle(std::vector<std::pair<std::string, int>> &du){
-  for(int i = 0; i < du.size(); i++){
-    if(du[i].second == 0 || du[i].second == 1){
-      return true;
+/**
+ * TSP_LinKernighan: Chained Lin-Kernighan. The starting order is first
+ * improved with Lin-Kernighan and Or-opt moves; then, until the time budget
+ * runs out, a random double-bridge kick is applied, the damage repaired
+ * with the same moves from only the cities around the kick, and the result
+ * kept if it is shorter than the best tour so far. The kicks are seeded by
+ * the stop count, so a run that ends after max_kicks rather than at the
+ * deadline always returns the same tour.
+ *
+ * @param  {DistanceMatrix} dist      : distances between the stops
+ * @param  {double} time_budget_ms    : wall-clock budget in milliseconds
+ * @param  {std::vector<int>} initial : starting order, empty for 0..n-1
+ * @param  {int} k                    : candidate neighbors per stop
+ * @param  {TSPProgress*} recorder    : if given, receives the progress instead
+ * of the returned pair
+ * @param  {int} max_kicks            : stop after this many kicks (0 = none)
+ * @param  {QueryContext*} ctx        : optional deadline or cancellation on
+ * top of the budget; the best tour so far is returned as partial
+ * @return {std::pair<double, std::vector<std::vector<int>>>} : a pair of
+ * total distance and every new best tour
+ */
+std::pair<double, std::vector<std::vector<int>>> TrojanMap::TSP_LinKernighan(
+    const DistanceMatrix &dist, double time_budget_ms,
+    std::vector<int> initial, int k, TSPProgress *recorder, int max_kicks,
+    QueryContext *ctx) {
+  if (ctx) ctx->status = QueryStatus::kComplete;
+  int n = dist.n;
+  if (n == 0) return {0, {}};
+  if (n == 1) return {0, {{0, 0}}};
+  if (initial.empty()) {
+    for (int i = 0; i < n; i++) initial.push_back(i);
+  }
+  LocalSearchTour search(dist, initial, k);
+  search.deadline = std::chrono::steady_clock::now() +
+                    std::chrono::microseconds(int64_t(time_budget_ms * 1000));
+  search.ctx = ctx;
+  auto move = [&](int a) {
+    return search.LinKernighanMove(a) || search.OrOptMove(a);
+  };
+  if (recorder) {
+    recorder->Reset(initial);
+    search.recorder = recorder;
+  }
+  std::vector<std::vector<int>> progress;
+  search.Optimize(move, [&]() { RecordSweep(search, progress); });
+
+  // Kicks that do not pay off are rolled back, so only new best tours are
+  // recorded from here on, as snapshots.
+  search.recorder = nullptr;
+  if (!recorder) progress = {search.ClosedTour()};
+  double best = search.Length();
+  std::vector<int> best_tour = search.tour;
+  std::mt19937 gen(n);
+  for (int kick = 0; n >= 8 && (max_kicks <= 0 || kick < max_kicks) &&
+                    !search.OutOfTime();
+       kick++) {
+    if (search.Perturb(gen, move, best, best_tour)) {
+      if (recorder) {
+        recorder->Snapshot(search.tour);
+        recorder->Frame();
+      } else {
+        progress.push_back(search.ClosedTour());
+      }
     }
   }
-  return false;
+  if (recorder) progress = {search.ClosedTour()};
+  if (ctx && ctx->Expired()) ctx->status = QueryStatus::kPartial;
+  return {TourLength(dist, progress.back()), progress};
 }
 
-bool TrojanMap::CycleDetection(std::vector<std::string> &subgraph,
-                               std::vector<double> &square) {
-
-  //求所有点的度
-  std::vector<std::pair<std::string, int>> du(subgraph.size());
-  for(int i = 0; i < subgraph.size(); i++){
-    std::string temp_id = subgraph[i];
-    du[i].first = temp_id;
-    du[i].second = 0;
-    std::vector<std::string> temp_neibor = GetNeighborIDs(temp_id);
-    
-    for(int j =0; j< temp_neibor.size(); j++){
-      std::vector<std::string>::iterator iter;
-      iter = find(subgraph.begin(),subgraph.end(),temp_neibor[j]);
-      if(iter != subgraph.end()){
-        du[i].second += 1;
+/**
+ * TravelingTrojan_LinKernighan: Best tour found by chained Lin-Kernighan
+ * within the time budget, for tours of hundreds to thousands of stops.
+ *
+ * @param  {std::vector<std::string>} input : a list of locations needs to visit
+ * @param  {double} time_budget_ms          : wall-clock budget in milliseconds
+ * @param  {TSPProgress*} progress          : optional compact progress record
+ * @param  {int} max_kicks                  : 0 = kick until the deadline
+ * @param  {QueryContext*} ctx              : optional deadline or cancellation
+ * @return {std::pair<double, std::vector<std::vector<std::string>>>} : a pair of
+ * total distance and the all the progress to get final path
+ */
+std::pair<double, std::vector<std::vector<std::string>>>
+TrojanMap::TravelingTrojan_LinKernighan(std::vector<std::string> location_ids,
+                                        double time_budget_ms,
+                                        TSPProgress *progress, int max_kicks,
+                                        QueryContext *ctx) {
+  return TourProgressToIds(
+      location_ids,
+      TSP_LinKernighan(BuildDistanceMatrix(location_ids), time_budget_ms, {},
+                       8, progress, max_kicks, ctx));
+}
+
+/**
+ * TSP_MultiStart: Iterated local search (2-opt and Or-opt moves with
+ * double-bridge kicks) on num_chains independent chains, run in parallel.
+ * Chain 0 starts from the greedy-edge tour and the others from random
+ * orders drawn from seed. The chains run in epochs of a fixed number of
+ * kicks; between epochs the worse half of the chains restarts from the
+ * global best tour. With the same seed and chain count, a run that stops
+ * after max_epochs rather than at the deadline always returns the same
+ * tour, whatever the thread timing.
+ *
+ * @param  {DistanceMatrix} dist   : distances between the stops
+ * @param  {double} time_budget_ms : wall-clock budget in milliseconds
+ * @param  {int} num_chains        : chains (0 = hardware concurrency)
+ * @param  {unsigned} seed         : seed of the random starts and kicks
+ * @param  {int} max_epochs        : stop after this many epochs (0 = none)
+ * @param  {QueryContext*} ctx     : optional deadline or cancellation; the
+ * global best so far is returned as partial
+ * @return {std::pair<double, std::vector<std::vector<int>>>} : a pair of
+ * total distance and the global best tour after every improving epoch
+ */
+std::pair<double, std::vector<std::vector<int>>> TrojanMap::TSP_MultiStart(
+    const DistanceMatrix &dist, double time_budget_ms, int num_chains,
+    unsigned seed, int max_epochs, QueryContext *ctx) {
+  int n = dist.n;
+  if (n < 8) return TSP_3opt(dist, {}, 10, nullptr, ctx);
+  if (ctx) ctx->status = QueryStatus::kComplete;
+  int threads = std::thread::hardware_concurrency();
+  if (threads <= 0) threads = 1;
+  if (num_chains <= 0) num_chains = threads;
+  const int kKicksPerEpoch = 200;
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::microseconds(int64_t(time_budget_ms * 1000));
+
+  std::vector<int> identity(n);
+  for (int i = 0; i < n; i++) identity[i] = i;
+  LocalSearchTour prototype(dist, identity, 8);
+  prototype.deadline = deadline;
+  prototype.ctx = ctx;
+  std::vector<LocalSearchTour> chains(num_chains, prototype);
+  std::vector<std::mt19937> gens;
+  std::vector<double> best(num_chains);
+  std::vector<std::vector<int>> best_tour(num_chains);
+  for (int c = 0; c < num_chains; c++) gens.emplace_back(seed + c);
+
+  auto run_epoch = [&](size_t c, int) {
+    LocalSearchTour &search = chains[c];
+    auto move = [&](int a) {
+      return search.TwoOptMove(a) || search.OrOptMove(a);
+    };
+    if (best_tour[c].empty()) {
+      std::vector<int> start = identity;
+      if (c == 0) {
+        start = TSP_InitialTour(dist, TourSeed::kGreedyEdge);
+      } else {
+        std::shuffle(start.begin(), start.end(), gens[c]);
       }
+      search.SetTour(start);
+      search.Optimize(move, nullptr);
+      best[c] = search.Length();
+      best_tour[c] = search.tour;
+    }
+    for (int i = 0; i < kKicksPerEpoch; i++) {
+      if (search.OutOfTime()) break;
+      search.Perturb(gens[c], move, best[c], best_tour[c]);
+    }
+  };
+
+  std::vector<std::vector<int>> progress;
+  double global = DBL_MAX;
+  for (int epoch = 0; max_epochs <= 0 || epoch < max_epochs; epoch++) {
+    ParallelFor(num_chains, std::min(threads, num_chains), run_epoch);
+    std::vector<int> rank(num_chains);
+    for (int c = 0; c < num_chains; c++) rank[c] = c;
+    std::stable_sort(rank.begin(), rank.end(),
+                     [&](int a, int b) { return best[a] < best[b]; });
+    if (best[rank[0]] < global) {
+      global = best[rank[0]];
+      chains[rank[0]].SetTour(best_tour[rank[0]]);
+      progress.push_back(chains[rank[0]].ClosedTour());
     }
-    // std::cout << du[i].first << std::endl;
-    // std::cout << du[i].second << std::endl;
+    if (prototype.OutOfTime()) break;
+    for (int r = (num_chains + 1) / 2; r < num_chains; r++) {
+      int c = rank[r];
+      best[c] = best[rank[0]];
+      best_tour[c] = best_tour[rank[0]];
+      chains[c].SetTour(best_tour[c]);
+    }
+  }
+  if (ctx && ctx->Expired()) ctx->status = QueryStatus::kPartial;
+  return {TourLength(dist, progress.back()), progress};
+}
+
+/**
+ * TravelingTrojan_MultiStart: Parallel anytime TSP; the best tour found by
+ * any chain when the budget expires.
+ *
+ * @param  {std::vector<std::string>} input : a list of locations needs to visit
+ * @param  {double} time_budget_ms          : wall-clock budget in milliseconds
+ * @param  {int} num_chains                 : 0 = hardware concurrency
+ * @param  {unsigned} seed                  : seed of the random starts
+ * @param  {int} max_epochs                 : 0 = run until the deadline
+ * @param  {QueryContext*} ctx              : optional deadline or cancellation
+ * @return {std::pair<double, std::vector<std::vector<std::string>>>} : a pair of
+ * total distance and the all the progress to get final path
+ */
+std::pair<double, std::vector<std::vector<std::string>>>
+TrojanMap::TravelingTrojan_MultiStart(std::vector<std::string> location_ids,
+                                      double time_budget_ms, int num_chains,
+                                      unsigned seed, int max_epochs,
+                                      QueryContext *ctx) {
+  return TourProgressToIds(
+      location_ids, TSP_MultiStart(BuildDistanceMatrix(location_ids),
+                                   time_budget_ms, num_chains, seed,
+                                   max_epochs, ctx));
+}
 
+/**
+ * TSP_Solve: Run one of the matrix solvers, so callers that build their own
+ * matrix (e.g. from road distances) can pick any of them. The exact solvers
+ * keep their size limits: past them the result is empty and ctx, if given,
+ * says kTooLarge.
+ *
+ * @param  {DistanceMatrix} dist   : distances between the stops
+ * @param  {TSPSolver} solver      : which solver to run
+ * @param  {double} time_budget_ms : budget of the anytime solvers
+ * @param  {QueryContext*} ctx     : passed on to the solver
+ * @return {std::pair<double, std::vector<std::vector<int>>>} : a pair of
+ * total distance and the progress of the solver
+ */
+std::pair<double, std::vector<std::vector<int>>> TrojanMap::TSP_Solve(
+    const DistanceMatrix &dist, TSPSolver solver, double time_budget_ms,
+    QueryContext *ctx) {
+  switch (solver) {
+    case TSPSolver::kHeldKarp:
+      return TSP_HeldKarp(dist, 0, ctx);
+    case TSPSolver::kBranchAndBound:
+      return TSP_BranchAndBound(dist, ctx);
+    case TSPSolver::kParallel:
+      return TSP_Parallel(dist, 2, 0, ctx);
+    case TSPSolver::k2opt:
+      return TSP_2opt(dist, {}, 10, nullptr, ctx);
+    case TSPSolver::k3opt:
+      break;
+    case TSPSolver::kLinKernighan:
+      return TSP_LinKernighan(dist, time_budget_ms, {}, 8, nullptr, 0, ctx);
+    case TSPSolver::kMultiStart:
+      return TSP_MultiStart(dist, time_budget_ms, 0, 0, 0, ctx);
   }
+  return TSP_3opt(dist, {}, 10, nullptr, ctx);
+}
+
+// Rotate an order so that it starts with stop 0.
+static std::vector<int> StartAtZero(std::vector<int> order) {
+  std::rotate(order.begin(), std::find(order.begin(), order.end(), 0),
+              order.end());
+  return order;
+}
+
+// Union-find with path halving.
+static int FindRoot(std::vector<int> &parent, int x) {
+  while (parent[x] != x) x = parent[x] = parent[parent[x]];
+  return x;
+}
 
-  while(IfDuHaveCycle(du)){
-    for(int i = 0; i < du.size(); i++){
-      if(du[i].second == 0){
-        du[i].second = -1;
+// Nearest neighbor: follow the candidate lists, scanning the remaining stops
+// only when every candidate is already used.
+static std::vector<int> NearestNeighborSeed(
+    const DistanceMatrix &dist, const std::vector<std::vector<int>> &cand) {
+  int n = dist.n;
+  std::vector<int> next_left(n + 1), prev_left(n + 1);  // unvisited list
+  for (int i = 0; i <= n; i++) {
+    next_left[i] = (i + 1) % (n + 1);
+    prev_left[i] = (i + n) % (n + 1);
+  }
+  auto remove = [&](int c) {
+    next_left[prev_left[c]] = next_left[c];
+    prev_left[next_left[c]] = prev_left[c];
+  };
+  std::vector<char> used(n, 0);
+  std::vector<int> order = {0};
+  used[0] = 1;
+  remove(0);
+  while (int(order.size()) < n) {
+    int from = order.back(), next = -1;
+    for (int c : cand[from]) {
+      if (!used[c]) {
+        next = c;
         break;
       }
-      if(du[i].second == 1){
-        du[i].second = -1;
-        std::vector<std::string> temp_neibor = GetNeighborIDs(du[i].first);
-        for(int j =0; j< temp_neibor.size(); j++){
-          std::vector<std::string>::iterator iter;
-          iter = find(subgraph.begin(),subgraph.end(),temp_neibor[j]);
-          if(iter != subgraph.end()){
-            for(int k = 0; k < du.size(); k++){
-              if(du[k].first.compare(*iter) == 0 && du[k].second >= 1){
-                du[k].second -= 1;
-              }
-            }
-          }
-        }
+    }
+    if (next < 0) {
+      for (int c = next_left[n]; c != n; c = next_left[c]) {
+        if (next < 0 || dist(from, c) < dist(from, next)) next = c;
       }
     }
+    used[next] = 1;
+    remove(next);
+    order.push_back(next);
   }
+  return order;
+}
 
-  for(int i = 0; i < du.size(); i++){
-     //std::cout << du[i].second << std::endl;
-    if(du[i].second > 1){
-      return true;
+// Greedy edge: take candidate edges shortest first while they keep every
+// stop at degree <= 2 and close no cycle, then chain the resulting paths
+// by nearest endpoint.
+static std::vector<int> GreedyEdgeSeed(
+    const DistanceMatrix &dist, const std::vector<std::vector<int>> &cand) {
+  int n = dist.n;
+  std::vector<std::pair<double, std::pair<int, int>>> edges;
+  for (int i = 0; i < n; i++) {
+    for (int c : cand[i]) {
+      edges.push_back({dist(i, c), {std::min(i, c), std::max(i, c)}});
     }
   }
+  std::sort(edges.begin(), edges.end());
+  std::vector<int> root(n), degree(n, 0);
+  std::vector<std::array<int, 2>> link(n, {-1, -1});
+  for (int i = 0; i < n; i++) root[i] = i;
+  for (auto &e : edges) {
+    int u = e.second.first, v = e.second.second;
+    if (degree[u] == 2 || degree[v] == 2) continue;
+    int ru = FindRoot(root, u), rv = FindRoot(root, v);
+    if (ru == rv) continue;
+    root[ru] = rv;
+    link[u][degree[u]++] = v;
+    link[v][degree[v]++] = u;
+  }
 
-  
+  // Walk every path fragment from one of its ends.
+  std::vector<std::vector<int>> fragments;
+  std::vector<char> seen(n, 0);
+  for (int i = 0; i < n; i++) {
+    if (seen[i] || degree[i] == 2) continue;
+    std::vector<int> path;
+    for (int prev = -1, cur = i; cur >= 0;) {
+      seen[cur] = 1;
+      path.push_back(cur);
+      int next = link[cur][0] != prev ? link[cur][0] : link[cur][1];
+      if (next >= 0 && seen[next]) next = -1;
+      prev = cur;
+      cur = next;
+    }
+    fragments.push_back(path);
+  }
 
-  
-  
-  
-  return false;
+  std::vector<int> order = fragments[0];
+  std::vector<char> joined(fragments.size(), 0);
+  joined[0] = 1;
+  for (size_t step = 1; step < fragments.size(); step++) {
+    int end = order.back(), best = -1;
+    double best_dist = DBL_MAX;
+    bool flip = false;
+    for (size_t f = 0; f < fragments.size(); f++) {
+      if (joined[f]) continue;
+      for (int side = 0; side < 2; side++) {
+        int at = side == 0 ? fragments[f].front() : fragments[f].back();
+        if (dist(end, at) < best_dist) {
+          best_dist = dist(end, at);
+          best = f;
+          flip = side == 1;
+        }
+      }
+    }
+    joined[best] = 1;
+    if (flip) {
+      order.insert(order.end(), fragments[best].rbegin(),
+                   fragments[best].rend());
+    } else {
+      order.insert(order.end(), fragments[best].begin(), fragments[best].end());
+    }
+  }
+  return order;
 }
 
-/**
- * FindNearby: Given a class name C, a location name L and a number r,
- * find all locations in class C on the map near L with the range of r and
+// Christofides-style: minimum spanning tree, greedy matching of its odd
+// degree stops (not the exact minimum matching), Euler circuit, shortcut.
+static std::vector<int> ChristofidesSeed(const DistanceMatrix &dist) {
+  int n = dist.n;
+  std::vector<std::vector<int>> graph(n);  // multigraph adjacency
+  std::vector<double> key(n, DBL_MAX);
+  std::vector<int> parent(n, -1);
+  std::vector<char> in_tree(n, 0);
+  key[0] = 0;
+  for (int added = 0; added < n; added++) {
+    int u = -1;
+    for (int v = 0; v < n; v++) {
+      if (!in_tree[v] && (u < 0 || key[v] < key[u])) u = v;
+    }
+    in_tree[u] = 1;
+    if (parent[u] >= 0) {
+      graph[u].push_back(parent[u]);
+      graph[parent[u]].push_back(u);
+    }
+    for (int v = 0; v < n; v++) {
+      if (!in_tree[v] && dist(u, v) < key[v]) {
+        key[v] = dist(u, v);
+        parent[v] = u;
+      }
+    }
+  }
+
+  std::vector<int> odd;
+  for (int i = 0; i < n; i++) {
+    if (graph[i].size() % 2) odd.push_back(i);
+  }
+  std::vector<std::pair<double, std::pair<int, int>>> pairs;
+  const int kMatchCandidates = 10;
+  for (size_t a = 0; a < odd.size(); a++) {
+    std::vector<int> others;
+    for (size_t b = 0; b < odd.size(); b++) {
+      if (b != a) others.push_back(odd[b]);
+    }
+    size_t k = std::min<size_t>(kMatchCandidates, others.size());
+    std::partial_sort(
+        others.begin(), others.begin() + k, others.end(),
+        [&](int x, int y) { return dist(odd[a], x) < dist(odd[a], y); });
+    for (size_t i = 0; i < k; i++) {
+      pairs.push_back({dist(odd[a], others[i]), {odd[a], others[i]}});
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+  std::vector<char> matched(n, 0);
+  auto match = [&](int u, int v) {
+    matched[u] = matched[v] = 1;
+    graph[u].push_back(v);
+    graph[v].push_back(u);
+  };
+  for (auto &p : pairs) {
+    if (!matched[p.second.first] && !matched[p.second.second]) {
+      match(p.second.first, p.second.second);
+    }
+  }
+  for (size_t a = 0; a < odd.size(); a++) {
+    if (matched[odd[a]]) continue;
+    int best = -1;
+    for (size_t b = a + 1; b < odd.size(); b++) {
+      if (matched[odd[b]]) continue;
+      if (best < 0 || dist(odd[a], odd[b]) < dist(odd[a], best)) best = odd[b];
+    }
+    if (best >= 0) match(odd[a], best);
+  }
+
+  // Hierholzer's algorithm, dropping an edge from both ends as it is used.
+  std::vector<std::multiset<int>> edges_left(n);
+  for (int u = 0; u < n; u++) {
+    edges_left[u].insert(graph[u].begin(), graph[u].end());
+  }
+  std::vector<int> stack = {0}, circuit;
+  while (!stack.empty()) {
+    int u = stack.back();
+    if (edges_left[u].empty()) {
+      circuit.push_back(u);
+      stack.pop_back();
+    } else {
+      int v = *edges_left[u].begin();
+      edges_left[u].erase(edges_left[u].begin());
+      edges_left[v].erase(edges_left[v].find(u));
+      stack.push_back(v);
+    }
+  }
+  std::vector<int> order;
+  std::vector<char> seen(n, 0);
+  for (int u : circuit) {
+    if (!seen[u]) {
+      seen[u] = 1;
+      order.push_back(u);
+    }
+  }
+  return order;
+}
+
+// Position of (x, y) along a Hilbert curve filling a 2^16 x 2^16 grid.
+static uint64_t HilbertIndex(uint32_t x, uint32_t y) {
+  uint64_t d = 0;
+  for (uint32_t s = 1u << 15; s > 0; s >>= 1) {
+    uint32_t rx = (x & s) > 0, ry = (y & s) > 0;
+    d += uint64_t(s) * s * ((3 * rx) ^ ry);
+    if (ry == 0) {
+      if (rx == 1) {
+        x = s - 1 - x;
+        y = s - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+// Space-filling curve: visit the stops in Hilbert curve order of position.
+static std::vector<int> SpaceFillingCurveSeed(
+    const std::vector<std::pair<double, double>> &coords) {
+  int n = coords.size();
+  double lat_min = DBL_MAX, lat_max = -DBL_MAX;
+  double lon_min = DBL_MAX, lon_max = -DBL_MAX;
+  for (auto &c : coords) {
+    lat_min = std::min(lat_min, c.first);
+    lat_max = std::max(lat_max, c.first);
+    lon_min = std::min(lon_min, c.second);
+    lon_max = std::max(lon_max, c.second);
+  }
+  double span = std::max(std::max(lat_max - lat_min, lon_max - lon_min), 1e-12);
+  std::vector<std::pair<uint64_t, int>> keyed(n);
+  for (int i = 0; i < n; i++) {
+    uint32_t x = (coords[i].second - lon_min) / span * 65535;
+    uint32_t y = (coords[i].first - lat_min) / span * 65535;
+    keyed[i] = {HilbertIndex(x, y), i};
+  }
+  std::sort(keyed.begin(), keyed.end());
+  std::vector<int> order;
+  for (auto &k : keyed) order.push_back(k.second);
+  return order;
+}
+
+/**
+ * TSP_InitialTour: Build a starting tour for local search. Nearest neighbor
+ * and greedy edge work from 10-nearest candidate lists, the space-filling
+ * curve is a sort, and Christofides-style uses a dense O(n^2) Prim since
+ * the matrix is dense anyway.
+ *
+ * @param  {DistanceMatrix} dist : distances between the stops
+ * @param  {TourSeed} seed       : heuristic to use
+ * @param  {std::vector<std::pair<double, double>>} coords : (lat, lon) of
+ * every stop, only used by kSpaceFillingCurve
+ * @return {std::vector<int>}    : an order of all stops, starting at 0
+ */
+std::vector<int> TrojanMap::TSP_InitialTour(
+    const DistanceMatrix &dist, TourSeed seed,
+    const std::vector<std::pair<double, double>> &coords) {
+  int n = dist.n;
+  std::vector<int> order(n);
+  for (int i = 0; i < n; i++) order[i] = i;
+  if (n <= 3) return order;
+  if (seed == TourSeed::kSpaceFillingCurve && int(coords.size()) != n) {
+    seed = TourSeed::kNearestNeighbor;
+  }
+  switch (seed) {
+    case TourSeed::kInputOrder:
+      return order;
+    case TourSeed::kNearestNeighbor:
+      return NearestNeighborSeed(dist, NearestCandidates(dist, 10));
+    case TourSeed::kGreedyEdge:
+      return StartAtZero(GreedyEdgeSeed(dist, NearestCandidates(dist, 10)));
+    case TourSeed::kChristofides:
+      return StartAtZero(ChristofidesSeed(dist));
+    case TourSeed::kSpaceFillingCurve:
+      return StartAtZero(SpaceFillingCurveSeed(coords));
+  }
+  return order;
+}
+
+/**
+ * GetCoordinates: (lat, lon) of every location id, in order.
+ */
+std::vector<std::pair<double, double>> TrojanMap::GetCoordinates(
+    const std::vector<std::string> &location_ids) {
+  std::vector<std::pair<double, double>> coords;
+  coords.reserve(location_ids.size());
+  for (auto &id : location_ids) {
+    auto it = id_to_index.find(id);
+    if (it != id_to_index.end()) {
+      coords.push_back({node_lat[it->second], node_lon[it->second]});
+    } else {
+      coords.push_back({data[id].lat, data[id].lon});
+    }
+  }
+  return coords;
+}
+
+/**
+ * TravelingTrojan_2opt: Improve a seed tour with 2-opt moves until no move
+ * shortens the tour. The greedy-edge seed makes the result independent of
+ * the order the stops are listed in.
+ *
+ * @param  {std::vector<std::string>} input : a list of locations needs to visit
+ * @param  {TourSeed} seed                  : construction of the first tour
+ * @param  {TSPProgress*} progress          : optional compact progress record
+ * @param  {QueryContext*} ctx              : optional deadline or cancellation
+ * @return {std::pair<double, std::vector<std::vector<std::string>>>} : a pair of
+ * total distance and the all the progress to get final path
+ */
+std::pair<double, std::vector<std::vector<std::string>>>
+TrojanMap::TravelingTrojan_2opt(std::vector<std::string> location_ids,
+                                TourSeed seed, TSPProgress *progress,
+                                QueryContext *ctx) {
+  DistanceMatrix dist = BuildDistanceMatrix(location_ids);
+  std::vector<int> initial =
+      TSP_InitialTour(dist, seed, GetCoordinates(location_ids));
+  return TourProgressToIds(location_ids,
+                           TSP_2opt(dist, initial, 10, progress, ctx));
+}
+
+/**
+ * BuildDistanceMatrix: Straight-line distance between every pair of the
+ * given locations, computed once so the solvers never go back to `data`.
+ *
+ * @param  {std::vector<std::string>} location_ids : locations
+ * @return {DistanceMatrix}                        : pairwise distances
+ */
+DistanceMatrix TrojanMap::BuildDistanceMatrix(
+    const std::vector<std::string> &location_ids) {
+  int n = location_ids.size();
+  std::vector<double> lat(n), lon(n);
+  for (int i = 0; i < n; i++) {
+    auto it = id_to_index.find(location_ids[i]);
+    if (it != id_to_index.end()) {
+      lat[i] = node_lat[it->second];
+      lon[i] = node_lon[it->second];
+    } else {
+      lat[i] = data[location_ids[i]].lat;
+      lon[i] = data[location_ids[i]].lon;
+    }
+  }
+  DistanceMatrix dist(n);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      if (i != j) dist(i, j) = HaversineMiles(lat[i], lon[i], lat[j], lon[j]);
+    }
+  }
+  return dist;
+}
+
+/**
+ * TourLength: Sum of the legs of a tour of matrix indices, in order, so the
+ * result matches CalculatePathLength on the same ids.
+ */
+double TrojanMap::TourLength(const DistanceMatrix &dist,
+                             const std::vector<int> &tour) {
+  double sum = 0;
+  for (int i = 0; i < int(tour.size()) - 1; i++) {
+    sum += dist(tour[i], tour[i + 1]);
+  }
+  return sum;
+}
+
+/**
+ * TourProgressToIds: Translate the index tours recorded by a matrix solver
+ * into the (total distance, progress) pair the TravelingTrojan_* functions
+ * return.
+ */
+std::pair<double, std::vector<std::vector<std::string>>>
+TrojanMap::TourProgressToIds(
+    const std::vector<std::string> &location_ids,
+    const std::pair<double, std::vector<std::vector<int>>> &progress) {
+  std::vector<std::vector<std::string>> records;
+  records.reserve(progress.second.size());
+  for (auto &tour : progress.second) {
+    std::vector<std::string> path;
+    path.reserve(tour.size());
+    for (int i : tour) path.push_back(location_ids[i]);
+    records.push_back(path);
+  }
+  return {progress.first, records};
+}
+
+/**
+ * TSP_HeldKarp: Exact TSP by dynamic programming over subsets. Stop 0 is the
+ * start; cost[mask * m + j] is the shortest path from stop 0 through the
+ * stops in mask ending at stop j + 1, where mask ranges over the other
+ * m = n - 1 stops. A layer only reads the layer below it, so the masks of
+ * one popcount are filled in parallel. Memory is 9 * 2^(n-1) * (n-1) bytes,
+ * about 90 MB at 20 stops, so inputs over kMaxHeldKarpStops are refused.
+ *
+ * @param  {DistanceMatrix} dist : distances between the stops
+ * @param  {int} num_threads     : worker threads (0 = hardware concurrency)
+ * @param  {QueryContext*} ctx   : optional deadline; checked per chunk of
+ * masks, and the result is empty on timeout or kTooLarge
+ * @return {std::pair<double, std::vector<std::vector<int>>>} : the optimal
+ * tour as the only progress entry
+ */
+std::pair<double, std::vector<std::vector<int>>> TrojanMap::TSP_HeldKarp(
+    const DistanceMatrix &dist, int num_threads, QueryContext *ctx) {
+  if (ctx) ctx->status = QueryStatus::kComplete;
+  int n = dist.n;
+  if (n > kMaxHeldKarpStops) {
+    if (ctx) ctx->status = QueryStatus::kTooLarge;
+    return {0, {}};
+  }
+  if (n == 0) return {0, {}};
+  if (n == 1) return {0, {{0, 0}}};
+  int m = n - 1;
+  size_t full = (size_t(1) << m) - 1;
+  std::vector<double> cost((full + 1) * m, DBL_MAX);
+  std::vector<uint8_t> parent((full + 1) * m, 0);
+
+  std::vector<std::vector<uint32_t>> layers(m + 1);
+  for (size_t mask = 1; mask <= full; mask++) {
+    layers[__builtin_popcount(mask)].push_back(mask);
+  }
+  for (int j = 0; j < m; j++) cost[(size_t(1) << j) * m + j] = dist(0, j + 1);
+
+  const size_t kChunk = 1024;
+  for (int k = 2; k <= m; k++) {
+    const std::vector<uint32_t> &layer = layers[k];
+    size_t chunks = (layer.size() + kChunk - 1) / kChunk;
+    ParallelFor(chunks, num_threads, [&](size_t c, int) {
+      if (ctx && ctx->Expired()) return;
+      size_t end = std::min(layer.size(), (c + 1) * kChunk);
+      for (size_t l = c * kChunk; l < end; l++) {
+        size_t mask = layer[l];
+        for (int j = 0; j < m; j++) {
+          if (!(mask >> j & 1)) continue;
+          size_t prev = mask ^ (size_t(1) << j);
+          const double *row = &cost[prev * m];
+          double best = DBL_MAX;
+          int best_i = 0;
+          for (int i = 0; i < m; i++) {
+            if (!(prev >> i & 1)) continue;
+            double c2 = row[i] + dist(i + 1, j + 1);
+            if (c2 < best) {
+              best = c2;
+              best_i = i;
+            }
+          }
+          cost[mask * m + j] = best;
+          parent[mask * m + j] = best_i;
+        }
+      }
+    });
+    if (ctx && ctx->Expired()) {
+      ctx->status = QueryStatus::kTimeout;
+      return {0, {}};
+    }
+  }
+
+  double best = DBL_MAX;
+  int last = 0;
+  for (int j = 0; j < m; j++) {
+    double c = cost[full * m + j] + dist(j + 1, 0);
+    if (c < best) {
+      best = c;
+      last = j;
+    }
+  }
+  std::vector<int> tour = {0};
+  size_t mask = full;
+  while (mask) {
+    tour.push_back(last + 1);
+    int prev = parent[mask * m + last];
+    mask ^= size_t(1) << last;
+    last = prev;
+  }
+  tour.push_back(0);
+  std::reverse(tour.begin(), tour.end());
+  return {TourLength(dist, tour), {tour}};
+}
+
+/**
+ * TravelingTrojan_HeldKarp: Exact TSP for up to kMaxHeldKarpStops stops. Past
+ * that the DP table would grow beyond 400 MB, so larger inputs get an empty
+ * result and kTooLarge.
+ *
+ * @param  {std::vector<std::string>} input : a list of locations needs to visit
+ * @param  {QueryContext*} ctx              : optional deadline or cancellation
+ * @return {std::pair<double, std::vector<std::vector<std::string>>} : a pair of
+ * total distance and the all the progress to get final path
+ */
+std::pair<double, std::vector<std::vector<std::string>>>
+TrojanMap::TravelingTrojan_HeldKarp(std::vector<std::string> location_ids,
+                                    QueryContext *ctx) {
+  return TourProgressToIds(
+      location_ids, TSP_HeldKarp(BuildDistanceMatrix(location_ids), 0, ctx));
+}
+
+// Search state of TSP_BranchAndBound, shared by every recursion level.
+class BranchAndBound {
+ public:
+  BranchAndBound(const DistanceMatrix &d) : dist(d), key(d.n), in_tree(d.n) {
+    nearest.resize(dist.n);
+    for (int i = 0; i < dist.n; i++) {
+      for (int j = 1; j < dist.n; j++) {
+        if (j != i) nearest[i].push_back(j);
+      }
+      std::sort(nearest[i].begin(), nearest[i].end(),
+                [&](int a, int b) { return dist(i, a) < dist(i, b); });
+    }
+  };
+
+  const DistanceMatrix &dist;
+  std::vector<std::vector<int>> nearest;  // stops 1..n-1 by distance from i
+  std::vector<int> path;
+  uint64_t visited = 0;
+  double best = DBL_MAX;
+  std::vector<int> best_path;
+  std::vector<std::vector<int>> progress;
+  std::vector<double> key;   // Prim scratch space
+  std::vector<char> in_tree;
+  // Incumbent shared with other searches running in parallel, or nullptr.
+  std::atomic<double> *shared_best = nullptr;
+  // Checked every 1024 nodes; once it expires every Search returns at once.
+  QueryContext *ctx = nullptr;
+  unsigned ticks = 0;
+  bool stopped = false;
+
+  // Greedy tour that always moves to the nearest unvisited stop.
+  std::vector<int> NearestNeighborTour() {
+    std::vector<int> tour = {0};
+    uint64_t used = 1;
+    while (int(tour.size()) < dist.n) {
+      for (int next : nearest[tour.back()]) {
+        if (!(used >> next & 1)) {
+          used |= uint64_t(1) << next;
+          tour.push_back(next);
+          break;
+        }
+      }
+    }
+    tour.push_back(0);
+    return tour;
+  }
+
+  // Lower bound on finishing the tour from cur: a minimum spanning tree over
+  // cur and the unvisited stops (any path through them is such a tree) plus
+  // the cheapest edge from an unvisited stop back to the start.
+  double LowerBound(int cur) {
+    int n = dist.n;
+    double back = DBL_MAX;
+    int remaining = 0;
+    for (int i = 0; i < n; i++) {
+      in_tree[i] = (visited >> i & 1) && i != cur;
+      key[i] = DBL_MAX;
+      if (!in_tree[i]) remaining++;
+      if (!(visited >> i & 1)) back = std::min(back, dist(i, 0));
+    }
+    double tree = 0;
+    int u = cur;
+    in_tree[u] = 1;
+    for (int added = 1; added < remaining; added++) {
+      int next = -1;
+      for (int v = 0; v < n; v++) {
+        if (in_tree[v]) continue;
+        key[v] = std::min(key[v], dist(u, v));
+        if (next < 0 || key[v] < key[next]) next = v;
+      }
+      tree += key[next];
+      in_tree[next] = 1;
+      u = next;
+    }
+    return tree + back;
+  }
+
+  void Search(int cur, double cost) {
+    if (stopped) return;
+    if (ctx && ++ticks % 1024 == 0 && ctx->Expired()) {
+      stopped = true;
+      return;
+    }
+    if (int(path.size()) == dist.n) {
+      cost += dist(cur, 0);
+      if (cost < best) {
+        best = cost;
+        best_path = path;
+        best_path.push_back(0);
+        if (shared_best) {
+          double seen = shared_best->load();
+          while (cost < seen && !shared_best->compare_exchange_weak(seen, cost)) {
+          }
+        } else {
+          progress.push_back(best_path);
+        }
+      }
+      return;
+    }
+    double bound = cost + LowerBound(cur);
+    if (bound >= best) return;
+    // Against the shared incumbent only cut subtrees that are strictly worse,
+    // with some slack for rounding, so that whichever thread publishes first
+    // no optimal tour is ever skipped.
+    if (shared_best && bound > shared_best->load() * (1 + 1e-12) + 1e-12) {
+      return;
+    }
+    for (int next : nearest[cur]) {
+      if (visited >> next & 1) continue;
+      double next_cost = cost + dist(cur, next);
+      if (next_cost >= best) break;  // children are nearest first
+      visited |= uint64_t(1) << next;
+      path.push_back(next);
+      Search(next, next_cost);
+      path.pop_back();
+      visited &= ~(uint64_t(1) << next);
+    }
+  }
+};
+
+/**
+ * TSP_BranchAndBound: Exact TSP by depth-first branch and bound. The
+ * nearest-neighbor tour is the first incumbent, every partial path carries
+ * its own cost, and a subtree is cut as soon as its cost plus the MST bound
+ * of the unvisited stops reaches the incumbent. Limited to
+ * kMaxBranchAndBoundStops by the visited bitmask.
+ *
+ * @param  {DistanceMatrix} dist : distances between the stops
+ * @param  {QueryContext*} ctx   : optional deadline; empty result on timeout
+ * or kTooLarge
+ * @return {std::pair<double, std::vector<std::vector<int>>>} : a pair of
+ * total distance and every improving tour
+ */
+std::pair<double, std::vector<std::vector<int>>>
+TrojanMap::TSP_BranchAndBound(const DistanceMatrix &dist, QueryContext *ctx) {
+  if (ctx) ctx->status = QueryStatus::kComplete;
+  int n = dist.n;
+  if (n > kMaxBranchAndBoundStops) {
+    if (ctx) ctx->status = QueryStatus::kTooLarge;
+    return {0, {}};
+  }
+  if (n == 0) return {0, {}};
+  if (n == 1) return {0, {{0, 0}}};
+  BranchAndBound search(dist);
+  search.ctx = ctx;
+
+  std::vector<int> tour = search.NearestNeighborTour();
+  search.best = TourLength(dist, tour);
+  search.best_path = tour;
+  search.progress.push_back(tour);
+
+  search.visited = 1;
+  search.path = {0};
+  search.Search(0, 0);
+  if (search.stopped) {
+    ctx->status = QueryStatus::kTimeout;
+    return {0, {}};
+  }
+  return {TourLength(dist, search.best_path), search.progress};
+}
+
+/**
+ * TravelingTrojan_BranchAndBound: Exact TSP with lower-bound pruning, for
+ * stop counts past what TravelingTrojan_Backtracking can finish. Empty with
+ * kTooLarge past kMaxBranchAndBoundStops.
+ *
+ * @param  {std::vector<std::string>} input : a list of locations needs to visit
+ * @param  {QueryContext*} ctx              : optional deadline or cancellation
+ * @return {std::pair<double, std::vector<std::vector<std::string>>>} : a pair of
+ * total distance and the all the progress to get final path
+ */
+std::pair<double, std::vector<std::vector<std::string>>>
+TrojanMap::TravelingTrojan_BranchAndBound(
+    std::vector<std::string> location_ids, QueryContext *ctx) {
+  return TourProgressToIds(
+      location_ids, TSP_BranchAndBound(BuildDistanceMatrix(location_ids), ctx));
+}
+
+// Runs a fixed list of tasks on a set of threads. Each worker takes tasks
+// from the back of its own deque and, once that is empty, steals from the
+// front of the other workers' deques.
+class WorkStealingPool {
+ public:
+  WorkStealingPool(int num_threads) {
+    if (num_threads <= 0) num_threads = std::thread::hardware_concurrency();
+    if (num_threads <= 0) num_threads = 1;
+    queues = std::vector<std::deque<size_t>>(num_threads);
+    locks = std::vector<std::mutex>(num_threads);
+  };
+
+  std::vector<std::deque<size_t>> queues;
+  std::vector<std::mutex> locks;
+
+  int Size() { return queues.size(); }
+
+  // Call fn(task, worker) once for every task in [0, num_tasks).
+  void Run(size_t num_tasks, const std::function<void(size_t, int)> &fn) {
+    int n = Size();
+    for (size_t t = 0; t < num_tasks; t++) {
+      queues[t * n / std::max<size_t>(num_tasks, 1)].push_back(t);
+    }
+    std::vector<std::thread> workers;
+    for (int w = 0; w < n; w++) {
+      workers.emplace_back([&, w]() {
+        size_t task;
+        while (Pop(w, task)) fn(task, w);
+      });
+    }
+    for (auto &t : workers) t.join();
+  }
+
+  bool Pop(int w, size_t &task) {
+    {
+      std::lock_guard<std::mutex> guard(locks[w]);
+      if (!queues[w].empty()) {
+        task = queues[w].back();
+        queues[w].pop_back();
+        return true;
+      }
+    }
+    for (int k = 1; k < Size(); k++) {
+      int victim = (w + k) % Size();
+      std::lock_guard<std::mutex> guard(locks[victim]);
+      if (!queues[victim].empty()) {
+        task = queues[victim].front();
+        queues[victim].pop_front();
+        return true;
+      }
+    }
+    return false;  // no task is ever added after Run starts
+  }
+};
+
+/**
+ * TSP_Parallel: Exact TSP with the permutation tree cut at split_depth. Each
+ * prefix becomes one branch-and-bound task; workers share the best cost
+ * through an atomic so a good tour found on one core prunes all of them.
+ * Every task reports its own best tour and the winner is the cheapest one,
+ * ties going to the earliest prefix, so the answer is the same however the
+ * tasks were scheduled.
+ *
+ * @param  {DistanceMatrix} dist : distances between the stops
+ * @param  {int} split_depth     : stops after the start fixed per task
+ * @param  {int} num_threads     : worker threads (0 = hardware concurrency)
+ * @param  {QueryContext*} ctx   : optional deadline; empty result on timeout
+ * or kTooLarge past kMaxBranchAndBoundStops
+ * @return {std::pair<double, std::vector<std::vector<int>>>} : a pair of
+ * total distance and the starting and final tours
+ */
+std::pair<double, std::vector<std::vector<int>>> TrojanMap::TSP_Parallel(
+    const DistanceMatrix &dist, int split_depth, int num_threads,
+    QueryContext *ctx) {
+  int n = dist.n;
+  if (n <= 3 || n > kMaxBranchAndBoundStops) {
+    return TSP_BranchAndBound(dist, ctx);
+  }
+  if (ctx) ctx->status = QueryStatus::kComplete;
+  split_depth = std::max(1, std::min(split_depth, n - 2));
+
+  // Enumerate the prefixes in lexicographic order.
+  std::vector<std::vector<int>> prefixes;
+  std::vector<int> prefix = {0};
+  std::function<void(uint64_t)> expand = [&](uint64_t used) {
+    if (int(prefix.size()) == split_depth + 1) {
+      prefixes.push_back(prefix);
+      return;
+    }
+    for (int next = 1; next < n; next++) {
+      if (used >> next & 1) continue;
+      prefix.push_back(next);
+      expand(used | uint64_t(1) << next);
+      prefix.pop_back();
+    }
+  };
+  expand(1);
+
+  WorkStealingPool pool(num_threads);
+  BranchAndBound prototype(dist);
+  std::vector<int> start = prototype.NearestNeighborTour();
+  std::atomic<double> shared_best(TourLength(dist, start));
+  std::vector<BranchAndBound> searches(pool.Size(), prototype);
+  std::vector<std::pair<double, std::vector<int>>> found(prefixes.size());
+
+  pool.Run(prefixes.size(), [&](size_t t, int w) {
+    BranchAndBound &search = searches[w];
+    search.shared_best = &shared_best;
+    search.ctx = ctx;
+    search.best = DBL_MAX;
+    search.best_path.clear();
+    search.path = prefixes[t];
+    search.visited = 0;
+    double cost = 0;
+    for (int i = 0; i < int(search.path.size()); i++) {
+      search.visited |= uint64_t(1) << search.path[i];
+      if (i > 0) cost += dist(search.path[i - 1], search.path[i]);
+    }
+    search.Search(search.path.back(), cost);
+    found[t] = {search.best, search.best_path};
+  });
+
+  for (auto &search : searches) {
+    if (search.stopped) {
+      ctx->status = QueryStatus::kTimeout;
+      return {0, {}};
+    }
+  }
+  std::vector<int> best = start;
+  double best_cost = TourLength(dist, start);
+  for (auto &f : found) {
+    if (!f.second.empty() && f.first < best_cost) {
+      best_cost = f.first;
+      best = f.second;
+    }
+  }
+  std::vector<std::vector<int>> progress = {start};
+  if (best != start) progress.push_back(best);
+  return {TourLength(dist, best), progress};
+}
+
+/**
+ * TravelingTrojan_Parallel: Exact TSP on all cores, up to
+ * kMaxBranchAndBoundStops stops.
+ *
+ * @param  {std::vector<std::string>} input : a list of locations needs to visit
+ * @param  {int} split_depth                : stops fixed per task
+ * @param  {int} num_threads                : 0 = hardware concurrency
+ * @param  {QueryContext*} ctx              : optional deadline or cancellation
+ * @return {std::pair<double, std::vector<std::vector<std::string>>>} : a pair of
+ * total distance and the all the progress to get final path
+ */
+std::pair<double, std::vector<std::vector<std::string>>>
+TrojanMap::TravelingTrojan_Parallel(std::vector<std::string> location_ids,
+                                    int split_depth, int num_threads,
+                                    QueryContext *ctx) {
+  return TourProgressToIds(
+      location_ids, TSP_Parallel(BuildDistanceMatrix(location_ids),
+                                 split_depth, num_threads, ctx));
+}
+
+CSVReader::CSVReader(const std::string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m != MAP_FAILED) {
+      madvise(m, st.st_size, MADV_SEQUENTIAL);
+      base_ = static_cast<const char *>(m);
+      size_ = st.st_size;
+      mapped_ = true;
+    }
+  }
+  close(fd);
+  if (!mapped_) {
+    std::ifstream fin(filename, std::ios::in | std::ios::binary);
+    if (!fin) return;
+    buffer_.assign(std::istreambuf_iterator<char>(fin),
+                   std::istreambuf_iterator<char>());
+    base_ = buffer_.data();
+    size_ = buffer_.size();
+  }
+  ok_ = true;
+}
+
+CSVReader::~CSVReader() {
+  if (mapped_) munmap(const_cast<char *>(base_), size_);
+}
+
+void CSVReader::ForEachRow(
+    const std::function<bool(const std::vector<std::string_view> &)> &fn,
+    bool skip_header) {
+  bool header = skip_header;
+  ForEachRow(contents(), [&](const std::vector<std::string_view> &fields) {
+    if (header) {
+      header = false;
+      return true;
+    }
+    return fn(fields);
+  });
+}
+
+void CSVReader::ForEachRow(
+    std::string_view text,
+    const std::function<bool(const std::vector<std::string_view> &)> &fn) {
+  auto blank = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+  const char *p = text.data(), *end = p + text.size();
+  std::vector<std::string_view> fields;
+  std::string scratch;
+  // Fields unescaped into scratch, as (field, offset in scratch); the views
+  // are made once the row is done so scratch may grow meanwhile.
+  std::vector<std::pair<size_t, size_t>> unescaped;
+  while (p < end) {
+    fields.clear();
+    scratch.clear();
+    unescaped.clear();
+    bool quoted_row = false;
+    while (true) {
+      while (p < end && blank(*p)) p++;
+      if (p < end && *p == '"') {
+        quoted_row = true;
+        const char *start = ++p;
+        bool escaped = false;
+        while (p < end && !(*p == '"' && (p + 1 == end || p[1] != '"'))) {
+          if (*p == '"') {
+            escaped = true;
+            p++;
+          }
+          p++;
+        }
+        if (escaped) {
+          unescaped.push_back({fields.size(), scratch.size()});
+          for (const char *c = start; c < p; c++) {
+            if (*c == '"') c++;
+            scratch.push_back(*c);
+          }
+          fields.emplace_back();
+        } else {
+          fields.push_back(std::string_view(start, p - start));
+        }
+        if (p < end) p++;  // closing quote
+        while (p < end && *p != ',' && *p != '\n') p++;
+      } else {
+        const char *start = p;
+        while (p < end && *p != ',' && *p != '\n') p++;
+        const char *stop = p;
+        while (stop > start && blank(stop[-1])) stop--;
+        fields.push_back(std::string_view(start, stop - start));
+      }
+      if (p < end && *p == ',') {
+        p++;
+        continue;
+      }
+      if (p < end) p++;  // end of line
+      break;
+    }
+    for (size_t k = 0; k < unescaped.size(); k++) {
+      size_t next = k + 1 < unescaped.size() ? unescaped[k + 1].second
+                                             : scratch.size();
+      fields[unescaped[k].first] = std::string_view(
+          scratch.data() + unescaped[k].second, next - unescaped[k].second);
+    }
+    if (fields.size() == 1 && fields[0].empty() && !quoted_row) continue;
+    if (!fn(fields)) return;
+  }
+}
+
+/**
+ * Given CSV filename, it read and parse locations data from CSV file,
+ * and return locations vector for topological sort problem.
+ *
+ * @param  {std::string} locations_filename     : locations_filename
+ * @return {std::vector<std::string>}           : locations
+ */
+std::vector<std::string> TrojanMap::ReadLocationsFromCSVFile(
+    std::string locations_filename) {
+  std::vector<std::string> location_names_from_csv;
+  CSVReader reader(locations_filename);
+  if (!reader.ok()) std::cout << "fail to read the location file." << std::endl;
+  reader.ForEachRow([&](const std::vector<std::string_view> &fields) {
+    for (auto field : fields) {
+      if (!field.empty()) location_names_from_csv.emplace_back(field);
+    }
+    return true;
+  });
+  return location_names_from_csv;
+}
+
+
+/**
+ * Given CSV filenames, it read and parse dependencise data from CSV file,
+ * and return dependencies vector for topological sort problem.
+ *
+ * @param  {std::string} dependencies_filename     : dependencies_filename
+ * @return {std::vector<std::vector<std::string>>} : dependencies
+ */
+std::vector<std::vector<std::string>> TrojanMap::ReadDependenciesFromCSVFile(
+    std::string dependencies_filename) {
+  std::vector<std::vector<std::string>> dependencies_from_csv;
+  CSVReader reader(dependencies_filename);
+  if (!reader.ok()) std::cout << "fail to read the dependency file." << std::endl;
+  reader.ForEachRow([&](const std::vector<std::string_view> &fields) {
+    std::vector<std::string> row;
+    for (auto field : fields) {
+      if (!field.empty()) row.emplace_back(field);
+    }
+    if (!row.empty()) dependencies_from_csv.push_back(std::move(row));
+    return true;
+  });
+  return dependencies_from_csv;
+}
+
+// Sorted, deduplicated names of the graph and their index.
+static DependencyGraph InternDependencyNames(
+    const std::vector<std::string> &locations) {
+  DependencyGraph graph;
+  graph.names = locations;
+  std::sort(graph.names.begin(), graph.names.end());
+  graph.names.erase(std::unique(graph.names.begin(), graph.names.end()),
+                    graph.names.end());
+  int n = graph.names.size();
+  graph.index.reserve(n);
+  for (int i = 0; i < n; i++) graph.index[graph.names[i]] = i;
+  return graph;
+}
+
+// Lay the (from, to) edges out as successor lists, in input order.
+static void BuildDependencyEdges(DependencyGraph &graph,
+                                 const std::vector<std::pair<int, int>> &edges) {
+  int n = graph.names.size();
+  graph.offset.assign(n + 1, 0);
+  graph.indegree.assign(n, 0);
+  for (auto &e : edges) {
+    graph.offset[e.first + 1]++;
+    graph.indegree[e.second]++;
+  }
+  for (int i = 0; i < n; i++) graph.offset[i + 1] += graph.offset[i];
+  graph.target.resize(edges.size());
+  std::vector<int> fill(graph.offset.begin(), graph.offset.end() - 1);
+  for (auto &e : edges) graph.target[fill[e.first]++] = e.second;
+}
+
+/**
+ * BuildDependencyGraph: Intern the location names in sorted order and build
+ * the successor lists from the dependency rows, where each name must come
+ * before the next name of its row. O(V log V + E).
+ *
+ * @param  {std::vector<std::string>} locations                     : locations
+ * @param  {std::vector<std::vector<std::string>>} dependencies     :
+ * prerequisites
+ * @return {DependencyGraph}                                        : the graph
+ */
+DependencyGraph TrojanMap::BuildDependencyGraph(
+    const std::vector<std::string> &locations,
+    const std::vector<std::vector<std::string>> &dependencies) {
+  DependencyGraph graph = InternDependencyNames(locations);
+  std::vector<std::pair<int, int>> edges;
+  for (auto &row : dependencies) {
+    for (size_t k = 1; k < row.size(); k++) {
+      auto from = graph.index.find(row[k - 1]);
+      auto to = graph.index.find(row[k]);
+      if (from == graph.index.end() || to == graph.index.end()) continue;
+      edges.push_back({from->second, to->second});
+    }
+  }
+  BuildDependencyEdges(graph, edges);
+  return graph;
+}
+
+/**
+ * BuildDependencyGraphFromCSVFile: Same as BuildDependencyGraph, but streams
+ * the dependency rows straight out of the CSV file without materializing
+ * them as strings first. Empty fields are skipped.
+ *
+ * @param  {std::vector<std::string>} location_names   : locations
+ * @param  {std::string} dependencies_filename          : dependencies CSV
+ * @return {DependencyGraph}                            : the graph
+ */
+DependencyGraph TrojanMap::BuildDependencyGraphFromCSVFile(
+    const std::vector<std::string> &location_names,
+    const std::string &dependencies_filename) {
+  DependencyGraph graph = InternDependencyNames(location_names);
+  // Views into graph.names, which no longer changes.
+  std::unordered_map<std::string_view, int> index;
+  index.reserve(graph.names.size());
+  for (size_t i = 0; i < graph.names.size(); i++) index[graph.names[i]] = i;
+
+  std::vector<std::pair<int, int>> edges;
+  CSVReader reader(dependencies_filename);
+  if (!reader.ok()) std::cout << "fail to read the dependency file." << std::endl;
+  reader.ForEachRow([&](const std::vector<std::string_view> &fields) {
+    int prev = -2;  // -2: no name yet in this row, -1: unknown name
+    for (auto field : fields) {
+      if (field.empty()) continue;
+      auto it = index.find(field);
+      int cur = it == index.end() ? -1 : it->second;
+      if (prev >= 0 && cur >= 0) edges.push_back({prev, cur});
+      prev = cur;
+    }
+    return true;
+  });
+  BuildDependencyEdges(graph, edges);
+  return graph;
+}
+
+// One cycle among the nodes Kahn's algorithm could not place (indegree still
+// positive), in edge order. Each such node has an unplaced predecessor, so
+// walking predecessors must come back to a node already on the walk.
+static std::vector<int> FindDependencyCycle(const DependencyGraph &graph,
+                                            const std::vector<int> &indegree) {
+  int n = graph.names.size();
+  std::vector<int> pred_offset(n + 1, 0), pred(graph.target.size());
+  for (int t : graph.target) pred_offset[t + 1]++;
+  for (int i = 0; i < n; i++) pred_offset[i + 1] += pred_offset[i];
+  std::vector<int> fill(pred_offset.begin(), pred_offset.end() - 1);
+  for (int u = 0; u < n; u++) {
+    for (int e = graph.offset[u]; e < graph.offset[u + 1]; e++) {
+      pred[fill[graph.target[e]]++] = u;
+    }
+  }
+
+  int cur = 0;
+  while (cur < n && indegree[cur] == 0) cur++;
+  if (cur == n) return {};
+  std::vector<int> step(n, -1), walk;
+  while (step[cur] < 0) {
+    step[cur] = walk.size();
+    walk.push_back(cur);
+    for (int e = pred_offset[cur]; e < pred_offset[cur + 1]; e++) {
+      if (indegree[pred[e]] > 0) {
+        cur = pred[e];
+        break;
+      }
+    }
+  }
+  std::vector<int> cycle(walk.begin() + step[cur], walk.end());
+  std::reverse(cycle.begin(), cycle.end());
+  return cycle;
+}
+
+/**
+ * DeliveringTrojan: Given a vector of location names, it should return a
+ * sorting of nodes that satisfies the given dependencies. If there is no way to
+ * do it, return a empty vector.
+ *
+ * Kahn's algorithm over the interned graph. Among the locations whose
+ * prerequisites are all placed, the smallest name goes next; since interned
+ * indices follow name order, a min-heap of indices does that in
+ * O(V log V + E) overall.
+ *
+ * @param  {std::vector<std::string>} locations                     : locations
+ * @param  {std::vector<std::vector<std::string>>} dependencies     :
+ * prerequisites
+ * @param  {std::vector<std::string>*} cycle                        : if given,
+ * receives the locations along one cycle when there is no sorting
+ * @return {std::vector<std::string>} results                       : results
+ */
+std::vector<std::string> TrojanMap::DeliveringTrojan(
+    std::vector<std::string> &locations,
+    std::vector<std::vector<std::string>> &dependencies,
+    std::vector<std::string> *cycle) {
+  if (cycle) cycle->clear();
+  DependencyGraph graph = BuildDependencyGraph(locations, dependencies);
+  int n = graph.names.size();
+  std::vector<int> indegree = graph.indegree;
+  std::priority_queue<int, std::vector<int>, std::greater<int>> ready;
+  for (int i = 0; i < n; i++) {
+    if (indegree[i] == 0) ready.push(i);
+  }
+  std::vector<std::string> result;
+  result.reserve(n);
+  while (!ready.empty()) {
+    int u = ready.top();
+    ready.pop();
+    result.push_back(graph.names[u]);
+    for (int e = graph.offset[u]; e < graph.offset[u + 1]; e++) {
+      if (--indegree[graph.target[e]] == 0) ready.push(graph.target[e]);
+    }
+  }
+  if (int(result.size()) < n) {
+    if (cycle) {
+      for (int i : FindDependencyCycle(graph, indegree)) {
+        cycle->push_back(graph.names[i]);
+      }
+    }
+    return {};
+  }
+  return result;
+}
+
+
+/**
+ * DeliveringTrojanLevels: Group the deliveries into levels, breadth-first
+ * Kahn over the same graph as DeliveringTrojan, then compute for every
+ * location the longest chain that starts at it, backwards level by level.
+ * The critical path follows those chain lengths from the top. The optional
+ * schedule fills each step with the ready locations whose remaining chain
+ * is longest (ties by name), which keeps the critical path moving. Levels
+ * and chain lengths are O(V + E); the schedule adds a log V heap factor.
+ *
+ * @param  {std::vector<std::string>} locations                     : locations
+ * @param  {std::vector<std::vector<std::string>>} dependencies     :
+ * prerequisites
+ * @param  {int} couriers                                           : couriers
+ * to schedule, 0 for none
+ * @return {DeliveryLevels}                                         : levels,
+ * critical path, schedule, or the cycle that prevents them
+ */
+DeliveryLevels TrojanMap::DeliveringTrojanLevels(
+    const std::vector<std::string> &locations,
+    const std::vector<std::vector<std::string>> &dependencies, int couriers) {
+  DeliveryLevels result;
+  DependencyGraph graph = BuildDependencyGraph(locations, dependencies);
+  int n = graph.names.size();
+  std::vector<int> indegree = graph.indegree;
+  std::vector<std::vector<int>> levels;
+  std::vector<int> frontier;
+  for (int i = 0; i < n; i++) {
+    if (indegree[i] == 0) frontier.push_back(i);
+  }
+  int placed = 0;
+  while (!frontier.empty()) {
+    placed += frontier.size();
+    std::vector<int> next;
+    for (int u : frontier) {
+      for (int e = graph.offset[u]; e < graph.offset[u + 1]; e++) {
+        if (--indegree[graph.target[e]] == 0) next.push_back(graph.target[e]);
+      }
+    }
+    std::sort(next.begin(), next.end());
+    levels.push_back(std::move(frontier));
+    frontier = std::move(next);
+  }
+  if (placed < n) {
+    for (int i : FindDependencyCycle(graph, indegree)) {
+      result.cycle.push_back(graph.names[i]);
+    }
+    return result;
+  }
+
+  for (auto &level : levels) {
+    result.levels.emplace_back();
+    for (int u : level) result.levels.back().push_back(graph.names[u]);
+  }
+
+  // chain[u]: locations on the longest dependency chain starting at u.
+  std::vector<int> chain(n, 1);
+  for (int l = int(levels.size()) - 1; l >= 0; l--) {
+    for (int u : levels[l]) {
+      for (int e = graph.offset[u]; e < graph.offset[u + 1]; e++) {
+        chain[u] = std::max(chain[u], chain[graph.target[e]] + 1);
+      }
+    }
+  }
+  if (n > 0) {
+    int u = levels[0][0];
+    for (int v : levels[0]) {
+      if (chain[v] > chain[u]) u = v;
+    }
+    while (true) {
+      result.critical_path.push_back(graph.names[u]);
+      int next = -1;
+      for (int e = graph.offset[u]; e < graph.offset[u + 1]; e++) {
+        int v = graph.target[e];
+        if (chain[v] == chain[u] - 1 && (next < 0 || v < next)) next = v;
+      }
+      if (next < 0) break;
+      u = next;
+    }
+  }
+
+  if (couriers > 0) {
+    indegree = graph.indegree;
+    auto later = [&](int a, int b) {
+      return chain[a] != chain[b] ? chain[a] < chain[b] : a > b;
+    };
+    std::priority_queue<int, std::vector<int>, decltype(later)> ready(later);
+    for (int i = 0; i < n; i++) {
+      if (indegree[i] == 0) ready.push(i);
+    }
+    std::vector<int> step;
+    while (!ready.empty()) {
+      step.clear();
+      while (!ready.empty() && int(step.size()) < couriers) {
+        step.push_back(ready.top());
+        ready.pop();
+      }
+      result.schedule.emplace_back();
+      for (int u : step) result.schedule.back().push_back(graph.names[u]);
+      for (int u : step) {
+        for (int e = graph.offset[u]; e < graph.offset[u + 1]; e++) {
+          if (--indegree[graph.target[e]] == 0) ready.push(graph.target[e]);
+        }
+      }
+    }
+  }
+  return result;
+}
+
+/**
+ * PrecedenceRoute_Exact: Dynamic programming over the sets of locations
+ * that can be visited first, i.e. those holding every prerequisite of their
+ * members. cost[mask * n + j] is the shortest route through mask ending at
+ * j; a location can be appended once all its prerequisites are in the mask.
+ * O(2^n n^2) time and 9 * 2^n * n bytes, so it is limited to
+ * kMaxPrecedenceExact locations.
+ *
+ * @param  {DistanceMatrix} dist   : distances between the locations
+ * @param  {DependencyGraph} graph : prerequisites, indexed like dist
+ * @param  {QueryContext*} ctx     : optional deadline; (-1, {}) on timeout
+ * or kTooLarge
+ * @return {std::pair<double, std::vector<int>>} : length and order
+ */
+std::pair<double, std::vector<int>> TrojanMap::PrecedenceRoute_Exact(
+    const DistanceMatrix &dist, const DependencyGraph &graph,
+    QueryContext *ctx) {
+  if (ctx) ctx->status = QueryStatus::kComplete;
+  int n = dist.n;
+  if (n == 0) return {0, {}};
+  if (n > kMaxPrecedenceExact) {
+    if (ctx) ctx->status = QueryStatus::kTooLarge;
+    return {-1, {}};
+  }
+  std::vector<uint32_t> before(n, 0);  // prerequisites of each location
+  for (int u = 0; u < n; u++) {
+    for (int e = graph.offset[u]; e < graph.offset[u + 1]; e++) {
+      before[graph.target[e]] |= uint32_t(1) << u;
+    }
+  }
+  size_t full = (size_t(1) << n) - 1;
+  std::vector<double> cost((full + 1) * n, DBL_MAX);
+  std::vector<int8_t> parent((full + 1) * n, -1);
+  for (int j = 0; j < n; j++) {
+    if (before[j] == 0) cost[(size_t(1) << j) * n + j] = 0;
+  }
+  for (size_t mask = 1; mask < full; mask++) {
+    if (ctx && ctx->Poll()) {
+      ctx->status = QueryStatus::kTimeout;
+      return {-1, {}};
+    }
+    for (int j = 0; j < n; j++) {
+      double c = cost[mask * n + j];
+      if (c == DBL_MAX) continue;
+      for (int k = 0; k < n; k++) {
+        if ((mask >> k & 1) || (before[k] & ~mask)) continue;
+        size_t next = (mask | size_t(1) << k) * n + k;
+        if (c + dist(j, k) < cost[next]) {
+          cost[next] = c + dist(j, k);
+          parent[next] = j;
+        }
+      }
+    }
+  }
+  int last = -1;
+  for (int j = 0; j < n; j++) {
+    if (cost[full * n + j] < DBL_MAX &&
+        (last < 0 || cost[full * n + j] < cost[full * n + last])) {
+      last = j;
+    }
+  }
+  if (last < 0) return {-1, {}};  // a cycle leaves no complete route
+  double length = cost[full * n + last];
+  std::vector<int> order;
+  for (size_t mask = full; last >= 0;) {
+    order.push_back(last);
+    int prev = parent[mask * n + last];
+    mask ^= size_t(1) << last;
+    last = prev;
+  }
+  std::reverse(order.begin(), order.end());
+  return {length, order};
+}
+
+// A route under precedence-constrained Or-opt. Besides the positions it
+// keeps, per location, the earliest position of a successor and the latest
+// position of a predecessor, so whether a segment may move to a gap is
+// decided in O(1): forward moves must stay before every successor of the
+// segment, backward moves after every predecessor.
+class PrecedenceRoute {
+ public:
+  PrecedenceRoute(const DistanceMatrix &d, const DependencyGraph &g,
+                  const std::vector<int> &order)
+      : dist(d), graph(g), n(d.n), route(order), pos(d.n), first_after(d.n),
+        last_before(d.n), source_offset(d.n + 1, 0), seen(d.n, 0) {
+    // Predecessor lists, the reverse of graph's successor lists.
+    for (int v : graph.target) source_offset[v + 1]++;
+    for (int v = 0; v < n; v++) source_offset[v + 1] += source_offset[v];
+    source.resize(graph.target.size());
+    std::vector<int> fill(source_offset.begin(), source_offset.end() - 1);
+    for (int u = 0; u < n; u++) {
+      for (int e = graph.offset[u]; e < graph.offset[u + 1]; e++) {
+        source[fill[graph.target[e]]++] = u;
+      }
+    }
+    for (int i = 0; i < n; i++) pos[route[i]] = i;
+    for (int u = 0; u < n; u++) {
+      UpdateFirstAfter(u);
+      UpdateLastBefore(u);
+    }
+  };
+
+  const DistanceMatrix &dist;
+  const DependencyGraph &graph;
+  int n;
+  std::vector<int> route;
+  std::vector<int> pos;
+  std::vector<int> first_after;  // earliest successor position, or n
+  std::vector<int> last_before;  // latest predecessor position, or -1
+  std::vector<int> source_offset;
+  std::vector<int> source;  // predecessors, like graph.offset/target
+  std::vector<int> seen;    // stamp per location, so each updates once
+  int stamp = 0;
+
+  void NextStamp() {
+    if (++stamp == 0) {
+      std::fill(seen.begin(), seen.end(), 0);
+      stamp = 1;
+    }
+  }
+
+  void UpdateFirstAfter(int u) {
+    first_after[u] = n;
+    for (int e = graph.offset[u]; e < graph.offset[u + 1]; e++) {
+      first_after[u] = std::min(first_after[u], pos[graph.target[e]]);
+    }
+  }
+
+  void UpdateLastBefore(int v) {
+    last_before[v] = -1;
+    for (int e = source_offset[v]; e < source_offset[v + 1]; e++) {
+      last_before[v] = std::max(last_before[v], pos[source[e]]);
+    }
+  }
+
+  // Distance between route positions, 0 past either end of the route.
+  double Gap(int a, int b) const {
+    if (a < 0 || b < 0 || a >= n || b >= n) return 0;
+    return dist(route[a], route[b]);
+  }
+
+  // Try to move the len locations at position i, in either orientation,
+  // next to a candidate of their end locations; apply the first that makes
+  // the route shorter and respects every dependency.
+  bool OrOptMove(int i, int len, const std::vector<std::vector<int>> &cand) {
+    int j = i + len - 1;
+    if (j >= n) return false;
+    int lo = n, hi = -1;  // bounds the segment's dependencies put on it
+    for (int k = i; k <= j; k++) {
+      lo = std::min(lo, first_after[route[k]]);
+      hi = std::max(hi, last_before[route[k]]);
+    }
+    // With a dependency inside the segment it could not be reversed, and
+    // the bounds above would be wrong; such segments stay put.
+    if (lo <= j || hi >= i) return false;
+    double removed = Gap(i - 1, i) + Gap(j, j + 1) - Gap(i - 1, j + 1);
+    if (removed <= 1e-10) return false;
+    for (int end = 0; end < 2; end++) {
+      int s = route[end == 0 ? i : j];
+      for (int c : cand[s]) {
+        if (dist(s, c) >= removed) break;
+        for (int side = 0; side < 2; side++) {
+          int p = pos[c] - side;  // insert between positions p and p + 1
+          if (p >= i - 1 && p <= j) continue;
+          if (p > j ? p >= lo : p + 1 <= hi) continue;
+          double base = Gap(p, p + 1);
+          double kept = InsertCost(p, i, j) - base;
+          double flipped = InsertCost(p, j, i) - base;
+          double delta = std::min(kept, flipped) - removed;
+          if (delta >= -1e-10) continue;
+          Move(i, j, p, flipped < kept);
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // Cost of linking the segment first..last into the gap after position p.
+  double InsertCost(int p, int first, int last) const {
+    double c = 0;
+    if (p >= 0) c += dist(route[p], route[first]);
+    if (p + 1 < n) c += dist(route[last], route[p + 1]);
+    return c;
+  }
+
+  // Move positions i..j into the gap after position p. Only positions
+  // min(i, p + 1)..max(j, p) change, so only the locations there and the
+  // bounds of their dependency neighbours are updated.
+  void Move(int i, int j, int p, bool reverse) {
+    if (reverse) std::reverse(route.begin() + i, route.begin() + j + 1);
+    if (p > j) {
+      std::rotate(route.begin() + i, route.begin() + j + 1,
+                  route.begin() + p + 1);
+    } else {
+      std::rotate(route.begin() + p + 1, route.begin() + i,
+                  route.begin() + j + 1);
+    }
+    int lo = std::min(i, p + 1), hi = std::max(j, p);
+    for (int k = lo; k <= hi; k++) pos[route[k]] = k;
+    NextStamp();
+    for (int k = lo; k <= hi; k++) {
+      int w = route[k];
+      for (int e = source_offset[w]; e < source_offset[w + 1]; e++) {
+        if (seen[source[e]] != stamp) {
+          seen[source[e]] = stamp;
+          UpdateFirstAfter(source[e]);
+        }
+      }
+    }
+    NextStamp();
+    for (int k = lo; k <= hi; k++) {
+      int w = route[k];
+      for (int e = graph.offset[w]; e < graph.offset[w + 1]; e++) {
+        if (seen[graph.target[e]] != stamp) {
+          seen[graph.target[e]] = stamp;
+          UpdateLastBefore(graph.target[e]);
+        }
+      }
+    }
+  }
+
+  double Length() const {
+    double sum = 0;
+    for (int k = 0; k + 1 < n; k++) sum += dist(route[k], route[k + 1]);
+    return sum;
+  }
+};
+
+/**
+ * PrecedenceRoute_LocalSearch: Start from a greedy route that always goes
+ * to the nearest location whose prerequisites are done, then apply Or-opt
+ * moves of one to three locations (optionally reversed) towards their
+ * nearest neighbors until none shortens the route. Every candidate move is
+ * checked against the dependencies in O(1).
+ *
+ * @param  {DistanceMatrix} dist   : distances between the locations
+ * @param  {DependencyGraph} graph : prerequisites, indexed like dist
+ * @param  {QueryContext*} ctx     : optional deadline; the route so far is
+ * returned as partial
+ * @return {std::pair<double, std::vector<int>>} : length and order
+ */
+std::pair<double, std::vector<int>> TrojanMap::PrecedenceRoute_LocalSearch(
+    const DistanceMatrix &dist, const DependencyGraph &graph,
+    QueryContext *ctx) {
+  if (ctx) ctx->status = QueryStatus::kComplete;
+  int n = dist.n;
+  if (n == 0) return {0, {}};
+  std::vector<int> indegree = graph.indegree, ready, order;
+  for (int i = 0; i < n; i++) {
+    if (indegree[i] == 0) ready.push_back(i);
+  }
+  while (!ready.empty()) {
+    size_t pick = 0;
+    if (!order.empty()) {
+      for (size_t r = 1; r < ready.size(); r++) {
+        if (dist(order.back(), ready[r]) < dist(order.back(), ready[pick])) {
+          pick = r;
+        }
+      }
+    }
+    int u = ready[pick];
+    ready[pick] = ready.back();
+    ready.pop_back();
+    order.push_back(u);
+    for (int e = graph.offset[u]; e < graph.offset[u + 1]; e++) {
+      if (--indegree[graph.target[e]] == 0) ready.push_back(graph.target[e]);
+    }
+  }
+  if (int(order.size()) < n) return {-1, {}};
+
+  PrecedenceRoute search(dist, graph, order);
+  std::vector<std::vector<int>> cand = NearestCandidates(dist, 10);
+  bool improved = true;
+  while (improved) {
+    improved = false;
+    for (int i = 0; i < n; i++) {
+      if (ctx && ctx->Poll()) {
+        ctx->status = QueryStatus::kPartial;
+        return {search.Length(), search.route};
+      }
+      for (int len = 1; len <= 3; len++) {
+        if (search.OrOptMove(i, len, cand)) improved = true;
+      }
+    }
+  }
+  return {search.Length(), search.route};
+}
+
+/**
+ * DeliveringTrojanRoute: Shortest route through the locations that respects
+ * the dependencies, exact for up to kMaxPrecedenceExact locations.
+ *
+ * @param  {std::vector<std::string>} locations                     : locations
+ * @param  {std::vector<std::vector<std::string>>} dependencies     :
+ * prerequisites
+ * @param  {QueryContext*} ctx                                      : optional
+ * deadline or cancellation
+ * @return {std::pair<double, std::vector<std::string>>}            : route
+ * length in miles and the locations in visiting order
+ */
+std::pair<double, std::vector<std::string>> TrojanMap::DeliveringTrojanRoute(
+    const std::vector<std::string> &locations,
+    const std::vector<std::vector<std::string>> &dependencies,
+    QueryContext *ctx) {
+  DependencyGraph graph = BuildDependencyGraph(locations, dependencies);
+  int n = graph.names.size();
+  std::vector<std::string> ids(n);
+  for (int i = 0; i < n; i++) {
+    ids[i] = GetID(graph.names[i]);
+    if (!id_to_index.count(ids[i])) return {-1, {}};
+  }
+  DistanceMatrix dist = BuildDistanceMatrix(ids);
+  auto route = n <= kMaxPrecedenceExact
+                   ? PrecedenceRoute_Exact(dist, graph, ctx)
+                   : PrecedenceRoute_LocalSearch(dist, graph, ctx);
+  std::vector<std::string> names;
+  for (int i : route.second) names.push_back(graph.names[i]);
+  return {route.first, names};
+}
+
+/**
+ * inSquare: Give a id return whether it is in square or not.
+ *
+ * @param  {std::string} id            : location id
+ * @param  {std::vector<double>} square: four vertexes of the square area
+ * @return {bool}                      : in square or not
+ */
+bool TrojanMap::inSquare(std::string id, std::vector<double> &square) {
+  if(GetLon(id) < square[0] || GetLon(id) > square[1]){
+    return false;
+  }
+
+  if(square[0] > square[1]){
+    return false;
+  } 
+  if(GetLat(id) > square[2] || GetLat(id) < square[3]){
+    return false;
+  }
+  if(square[3] > square[2]){
+    return false;
+  }
+  return true;
+}
+
+/**
+ * GetSubgraph: Give four vertexes of the square area, return a list of location
+ * ids in the squares
+ *
+ * @param  {std::vector<double>} square         : four vertexes of the square
+ * area
+ * @return {std::vector<std::string>} subgraph  : list of location ids in the
+ * square
+ */
+std::vector<std::string> TrojanMap::GetSubgraph(std::vector<double> &square) {
+  // include all the nodes in subgraph
+  std::vector<std::string> subgraph;
+  std::unordered_map<std::string, Node>::iterator iter;
+  for (iter = data.begin(); iter != data.end(); ++iter){
+      if(inSquare(iter -> first, square)){
+          subgraph.push_back(iter -> first);
+      }
+      
+  }
+
+  return subgraph;
+}
+
+/**
+ * Cycle Detection: Given four points of the square-shape subgraph, return true
+ * if there is a cycle path inside the square, false otherwise. Union-find over
+ * the roads between subgraph nodes: the first road joining two nodes that are
+ * already connected closes a cycle. O(V + E) time and O(V) memory in the
+ * subgraph.
+ *
+ * @param {std::vector<std::string>} subgraph: list of location ids in the
+ * square
+ * @param {std::vector<double>} square: four vertexes of the square area
+ * @param {std::vector<std::string>*} cycle: if not null, receives the ids of
+ * one cycle in order (first id not repeated), or is cleared if none
+ * @return {bool}: whether there is a cycle or not
+ */
+bool TrojanMap::CycleDetection(std::vector<std::string> &subgraph,
+                               std::vector<double> &square,
+                               std::vector<std::string> *cycle) {
+  if (cycle) cycle->clear();
+  // Union-find over slots 0..k-1 of the subgraph nodes, so nothing is sized
+  // by the whole graph.
+  std::unordered_map<int, int> slot;  // node index -> slot
+  std::vector<int> nodes;             // slot -> node index
+  slot.reserve(subgraph.size());
+  nodes.reserve(subgraph.size());
+  for (auto &id : subgraph) {
+    auto it = id_to_index.find(id);
+    if (it == id_to_index.end()) continue;
+    if (slot.emplace(it->second, nodes.size()).second) {
+      nodes.push_back(it->second);
+    }
+  }
+
+  int k = nodes.size();
+  std::vector<int> parent(k);
+  for (int s = 0; s < k; s++) parent[s] = s;
+  // Spanning forest so far, only kept to recover the witness.
+  std::vector<std::vector<int>> forest(cycle ? k : 0);
+  for (int su = 0; su < k; su++) {
+    int u = nodes[su];
+    for (int e = adj_offset[u]; e < adj_offset[u + 1]; e++) {
+      auto it = slot.find(adj_target[e]);
+      if (it == slot.end() || it->second <= su) continue;  // each road once
+      int sv = it->second;
+      int ru = FindRoot(parent, su), rv = FindRoot(parent, sv);
+      if (ru != rv) {
+        parent[ru] = rv;
+        if (cycle) {
+          forest[su].push_back(sv);
+          forest[sv].push_back(su);
+        }
+        continue;
+      }
+      if (!cycle) return true;
+      // The forest path from v back to u plus the road u-v is the cycle.
+      std::unordered_map<int, int> prev{{sv, sv}};
+      std::queue<int> q;
+      q.push(sv);
+      while (!q.empty() && !prev.count(su)) {
+        int x = q.front();
+        q.pop();
+        for (int y : forest[x]) {
+          if (prev.emplace(y, x).second) q.push(y);
+        }
+      }
+      for (int x = su; x != sv; x = prev[x]) {
+        cycle->push_back(index_to_id[nodes[x]]);
+      }
+      cycle->push_back(index_to_id[nodes[sv]]);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * AnalyzeRegions: Report the nodes, roads, components and whether there is a
+ * cycle inside each square, with the same bounds rules as inSquare. Nodes are
+ * bucketed into a uniform lat/lon grid, so a square only looks at the cells
+ * it overlaps instead of the whole map. Every worker owns its membership and
+ * union-find arrays, which are only touched for nodes of the current square.
+ *
+ * @param  {std::vector<std::vector<double>>} squares : {left lon, right lon,
+ * upper lat, lower lat} each
+ * @param  {int} num_threads                          : worker threads
+ * @param  {std::vector<std::vector<std::string>>*} subgraphs : optional ids
+ * inside each square
+ * @return {std::vector<RegionReport>}                : one per square
+ */
+std::vector<RegionReport> TrojanMap::AnalyzeRegions(
+    const std::vector<std::vector<double>> &squares, int num_threads,
+    std::vector<std::vector<std::string>> *subgraphs) {
+  std::vector<RegionReport> reports(squares.size());
+  if (subgraphs) subgraphs->assign(squares.size(), {});
+  int n = index_to_id.size();
+  if (n == 0 || squares.empty()) return reports;
+
+  // About four nodes per cell.
+  double min_lat = *std::min_element(node_lat.begin(), node_lat.end());
+  double max_lat = *std::max_element(node_lat.begin(), node_lat.end());
+  double min_lon = *std::min_element(node_lon.begin(), node_lon.end());
+  double max_lon = *std::max_element(node_lon.begin(), node_lon.end());
+  int side = std::max(1, int(sqrt(n / 4.0)));
+  double lat_scale = max_lat > min_lat ? side / (max_lat - min_lat) : 0;
+  double lon_scale = max_lon > min_lon ? side / (max_lon - min_lon) : 0;
+  auto row_of = [&](double lat) {
+    return std::min(side - 1, std::max(0, int((lat - min_lat) * lat_scale)));
+  };
+  auto col_of = [&](double lon) {
+    return std::min(side - 1, std::max(0, int((lon - min_lon) * lon_scale)));
+  };
+  std::vector<int> cell_offset(side * side + 1, 0), cell_nodes(n);
+  for (int i = 0; i < n; i++) {
+    cell_offset[row_of(node_lat[i]) * side + col_of(node_lon[i]) + 1]++;
+  }
+  for (int c = 0; c < side * side; c++) cell_offset[c + 1] += cell_offset[c];
+  std::vector<int> fill(cell_offset.begin(), cell_offset.end() - 1);
+  for (int i = 0; i < n; i++) {
+    cell_nodes[fill[row_of(node_lat[i]) * side + col_of(node_lon[i])]++] = i;
+  }
+
+  int threads = num_threads;
+  if (threads <= 0) threads = std::thread::hardware_concurrency();
+  if (threads <= 0) threads = 1;
+  class Scratch {
+   public:
+    std::vector<int> mark;  // square number + 1 of the nodes inside it
+    std::vector<int> parent;
+    std::vector<int> nodes;
+  };
+  std::vector<Scratch> scratch(threads);
+  ParallelFor(squares.size(), threads, [&](size_t q, int w) {
+    const std::vector<double> &sq = squares[q];
+    if (sq.size() < 4 || sq[0] > sq[1] || sq[3] > sq[2]) return;
+    if (sq[1] < min_lon || sq[0] > max_lon || sq[2] < min_lat ||
+        sq[3] > max_lat) {
+      return;
+    }
+    Scratch &s = scratch[w];
+    if (s.mark.empty()) {
+      s.mark.assign(n, 0);
+      s.parent.resize(n);
+    }
+    int stamp = q + 1;
+    s.nodes.clear();
+    for (int r = row_of(sq[3]); r <= row_of(sq[2]); r++) {
+      for (int c = col_of(sq[0]); c <= col_of(sq[1]); c++) {
+        int cell = r * side + c;
+        for (int k = cell_offset[cell]; k < cell_offset[cell + 1]; k++) {
+          int u = cell_nodes[k];
+          if (node_lon[u] < sq[0] || node_lon[u] > sq[1] ||
+              node_lat[u] > sq[2] || node_lat[u] < sq[3]) {
+            continue;
+          }
+          s.mark[u] = stamp;
+          s.parent[u] = u;
+          s.nodes.push_back(u);
+        }
+      }
+    }
+
+    RegionReport &report = reports[q];
+    report.nodes = s.nodes.size();
+    int merges = 0;
+    for (int u : s.nodes) {
+      for (int e = adj_offset[u]; e < adj_offset[u + 1]; e++) {
+        int v = adj_target[e];
+        if (v <= u || s.mark[v] != stamp) continue;
+        report.edges++;
+        int ru = FindRoot(s.parent, u), rv = FindRoot(s.parent, v);
+        if (ru == rv) continue;
+        s.parent[ru] = rv;
+        merges++;
+      }
+    }
+    report.components = report.nodes - merges;
+    report.has_cycle = report.edges > merges;
+    if (subgraphs) {
+      auto &ids = (*subgraphs)[q];
+      ids.reserve(s.nodes.size());
+      for (int u : s.nodes) ids.push_back(index_to_id[u]);
+    }
+  });
+  return reports;
+}
+
+/**
+ * FindNearby: Given a class name C, a location name L and a number r,
+ * find all locations in class C on the map near L with the range of r and
  * return a vector of string ids
  *
  * @param {std::string} className: the name of the class
@@ -904,48 +3354,699 @@ std::vector<std::string> TrojanMap::FindNearby(std::string attributesName,
   return res;
 }
 
+// Characters the map CSV uses for quoting and set syntax; they are dropped
+// from every field.
+static bool IsMapCSVDecoration(char c) {
+  return c == '\'' || c == '"' || c == '{' || c == '}';
+}
+
+// Parse one data.csv row: id,lat,lon,name followed by the attribute and
+// neighbor sets, e.g. "{'school'}","{'123', '456'}". Set entries are told
+// apart by their first character: letters are attributes, digits node ids.
+static void ParseMapCSVRow(const char *p, const char *end, Node &n) {
+  auto field = [&](std::string &out) {
+    out.clear();
+    for (; p < end && *p != ','; p++) {
+      if (!IsMapCSVDecoration(*p)) out.push_back(*p);
+    }
+    if (p < end) p++;
+  };
+  auto number = [&]() {
+    char buf[32];
+    size_t len = 0;
+    for (; p < end && *p != ','; p++) {
+      if (len + 1 < sizeof(buf) && !IsMapCSVDecoration(*p)) buf[len++] = *p;
+    }
+    if (p < end) p++;
+    buf[len] = '\0';
+    return strtod(buf, nullptr);
+  };
+  field(n.id);
+  n.lat = number();
+  n.lon = number();
+  field(n.name);
+  std::string word;
+  while (p < end) {
+    word.clear();
+    for (; p < end && *p != ','; p++) {
+      if (!IsMapCSVDecoration(*p) && *p != ' ') word.push_back(*p);
+    }
+    if (p < end) p++;
+    if (word.empty()) continue;
+    if (isalpha(word[0])) n.attributes.insert(word);
+    if (isdigit(word[0])) n.neighbors.push_back(word);
+  }
+}
+
 /**
- * CreateGraphFromCSVFile: Read the map data from the csv file
+ * CreateGraphFromCSVFile: Read the map data from the csv file. The file is
+ * split at line boundaries into chunks that are parsed on up to num_threads
+ * threads (0 = one per hardware thread) and then merged into `data` in file
+ * order, so a later row with the same id still wins.
  *
+ * @param  {std::string} filename : map CSV, one node per line
+ * @param  {int} num_threads      : worker threads
  */
-void TrojanMap::CreateGraphFromCSVFile() {
-  // Do not change this function
-  std::fstream fin;
-  fin.open("src/lib/data.csv", std::ios::in);
-  std::string line, word;
-
-  getline(fin, line);
-  while (getline(fin, line)) {
-    std::stringstream s(line);
-
-    Node n;
-    int count = 0;
-    while (getline(s, word, ',')) {
-      word.erase(std::remove(word.begin(), word.end(), '\''), word.end());
-      word.erase(std::remove(word.begin(), word.end(), '"'), word.end());
-      word.erase(std::remove(word.begin(), word.end(), '{'), word.end());
-      word.erase(std::remove(word.begin(), word.end(), '}'), word.end());
-      if (count == 0)
-        n.id = word;
-      else if (count == 1)
-        n.lat = stod(word);
-      else if (count == 2)
-        n.lon = stod(word);
-      else if (count == 3)
-        n.name = word;
-      else {
-        word.erase(std::remove(word.begin(), word.end(), ' '), word.end());
-        if (isalpha(word[0])) n.attributes.insert(word);
-        if (isdigit(word[0])) n.neighbors.push_back(word);
-      }
-      count++;
-    }
-    data[n.id] = n;
-  }
-  fin.close();
+void TrojanMap::CreateGraphFromCSVFile(const std::string &filename,
+                                       int num_threads) {
+  CSVReader reader(filename);
+  std::string_view text = reader.contents();
+  size_t begin = text.find('\n');  // header
+  begin = begin == std::string_view::npos ? text.size() : begin + 1;
+
+  // Chunks of at least 64 KiB, a few per thread so slow ones balance out.
+  int threads = num_threads;
+  if (threads <= 0) threads = std::thread::hardware_concurrency();
+  if (threads <= 0) threads = 1;
+  size_t target =
+      std::max<size_t>((text.size() - begin) / (threads * 4), 1 << 16);
+  std::vector<size_t> bounds{begin};
+  while (bounds.back() < text.size()) {
+    size_t next = bounds.back() + target;
+    if (next >= text.size()) {
+      next = text.size();
+    } else {
+      next = text.find('\n', next);
+      next = next == std::string_view::npos ? text.size() : next + 1;
+    }
+    bounds.push_back(next);
+  }
+
+  std::vector<std::vector<Node>> chunks(bounds.size() - 1);
+  ParallelFor(chunks.size(), threads, [&](size_t c, int) {
+    const char *p = text.data() + bounds[c];
+    const char *end = text.data() + bounds[c + 1];
+    chunks[c].reserve((end - p) / 64);
+    while (p < end) {
+      const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+      if (eol == nullptr) eol = end;
+      const char *stop = eol;
+      if (stop > p && stop[-1] == '\r') stop--;
+      if (stop > p) {
+        chunks[c].emplace_back();
+        ParseMapCSVRow(p, stop, chunks[c].back());
+      }
+      p = eol + (eol < end);
+    }
+  });
+
+  size_t total = data.size();
+  for (auto &chunk : chunks) total += chunk.size();
+  data.reserve(total);
+  for (auto &chunk : chunks) {
+    for (auto &n : chunk) {
+      std::string id = n.id;
+      data[std::move(id)] = std::move(n);
+    }
+  }
 }
 
 // define the rule for search for a min value in map
 bool cmp_value(const std::pair<std::string, double> left, const std::pair<std::string, double> right){
   return left.second < right.second;
-}
\ No newline at end of file
+}
+/**
+ * LoadMap: Replace the map with the one in a CSV file and rebuild the dense
+ * index, the connectivity and the caches from it.
+ *
+ * @param  {std::string} filename : map CSV, one node per line
+ * @param  {int} num_threads      : parser threads
+ */
+void TrojanMap::LoadMap(const std::string &filename, int num_threads) {
+  data.clear();
+  CreateGraphFromCSVFile(filename, num_threads);
+  BuildGraphIndex();
+  BuildConnectivity();
+}
+
+/**
+ * BuildGraphIndex: Build the dense index of `data`. Ids are sorted so node
+ * indices are the same on every run. The facility tables and road matrices
+ * are indexed by the old graph, so they are dropped.
+ */
+void TrojanMap::BuildGraphIndex() {
+  index_to_id.clear();
+  id_to_index.clear();
+  category_index.clear();
+  facility_tables.clear();
+  road_matrix_cache.Clear();
+  index_to_id.reserve(data.size());
+  for (auto &kv : data) index_to_id.push_back(kv.first);
+  std::sort(index_to_id.begin(), index_to_id.end());
+
+  int n = index_to_id.size();
+  id_to_index.reserve(n);
+  node_lat.assign(n, 0);
+  node_lon.assign(n, 0);
+  for (int i = 0; i < n; i++) {
+    id_to_index[index_to_id[i]] = i;
+    const Node &node = data[index_to_id[i]];
+    node_lat[i] = node.lat;
+    node_lon[i] = node.lon;
+    for (auto &attribute : node.attributes) category_index[attribute].push_back(i);
+  }
+
+  adj_offset.assign(n + 1, 0);
+  adj_target.clear();
+  adj_weight.clear();
+  for (int i = 0; i < n; i++) {
+    for (auto &neighbor : data[index_to_id[i]].neighbors) {
+      auto it = id_to_index.find(neighbor);
+      if (it == id_to_index.end()) continue;
+      int j = it->second;
+      adj_target.push_back(j);
+      adj_weight.push_back(
+          HaversineMiles(node_lat[i], node_lon[i], node_lat[j], node_lon[j]));
+    }
+    adj_offset[i + 1] = adj_target.size();
+  }
+}
+
+/**
+ * BuildConnectivity: One iterative depth-first search (Tarjan's low-link) per
+ * component finds the components, bridges, articulation points and
+ * biconnected blocks together. Roads are assumed two-way, as in data.csv.
+ */
+void TrojanMap::BuildConnectivity() {
+  int n = index_to_id.size();
+  Connectivity &c = connectivity;
+  c.component.assign(n, -1);
+  c.num_components = 0;
+  c.bridges.clear();
+  c.articulation_points.clear();
+  c.blocks.clear();
+
+  std::vector<int> disc(n, -1), low(n, 0), parent(n, -1), next_edge(n, 0);
+  std::vector<bool> articulation(n, false);
+  std::vector<int> stack;
+  std::vector<std::pair<int, int>> edges;  // tree and back edges, DFS order
+  int time = 0;
+  for (int root = 0; root < n; root++) {
+    if (disc[root] >= 0) continue;
+    int id = c.num_components++;
+    int root_children = 0;
+    disc[root] = low[root] = time++;
+    c.component[root] = id;
+    next_edge[root] = adj_offset[root];
+    stack.push_back(root);
+    while (!stack.empty()) {
+      int u = stack.back();
+      if (next_edge[u] < adj_offset[u + 1]) {
+        int v = adj_target[next_edge[u]++];
+        if (disc[v] < 0) {
+          parent[v] = u;
+          disc[v] = low[v] = time++;
+          c.component[v] = id;
+          next_edge[v] = adj_offset[v];
+          edges.push_back({u, v});
+          stack.push_back(v);
+          if (u == root) root_children++;
+        } else if (v != parent[u] && disc[v] < disc[u]) {
+          low[u] = std::min(low[u], disc[v]);
+          edges.push_back({u, v});
+        }
+        continue;
+      }
+      stack.pop_back();
+      int p = parent[u];
+      if (p < 0) continue;
+      low[p] = std::min(low[p], low[u]);
+      if (low[u] > disc[p]) {
+        c.bridges.push_back({std::min(p, u), std::max(p, u)});
+      }
+      if (low[u] >= disc[p]) {
+        if (p != root) articulation[p] = true;
+        // Everything pushed since the tree edge p-u is one block.
+        std::vector<int> block;
+        while (true) {
+          auto e = edges.back();
+          edges.pop_back();
+          block.push_back(e.first);
+          block.push_back(e.second);
+          if (e.first == p && e.second == u) break;
+        }
+        std::sort(block.begin(), block.end());
+        block.erase(std::unique(block.begin(), block.end()), block.end());
+        c.blocks.push_back(std::move(block));
+      }
+    }
+    if (root_children > 1) articulation[root] = true;
+  }
+  for (int i = 0; i < n; i++) {
+    if (articulation[i]) c.articulation_points.push_back(i);
+  }
+  std::sort(c.bridges.begin(), c.bridges.end());
+}
+
+/**
+ * IsReachable: Whether two locations are in the same connected component.
+ *
+ * @param  {std::string} id1 : location id
+ * @param  {std::string} id2 : location id
+ * @return {bool}            : false if either id is unknown
+ */
+bool TrojanMap::IsReachable(const std::string &id1,
+                            const std::string &id2) const {
+  auto a = id_to_index.find(id1);
+  auto b = id_to_index.find(id2);
+  if (a == id_to_index.end() || b == id_to_index.end()) return false;
+  if (connectivity.component.size() != index_to_id.size()) return true;
+  return connectivity.component[a->second] ==
+         connectivity.component[b->second];
+}
+
+/**
+ * BoundedDijkstra: Dijkstra from a node index that stops once the next node
+ * is farther than budget. Only the entries listed in order are written, so
+ * the caller can reset dist cheaply and reuse it for the next source.
+ *
+ * @param  {int} source               : source node index
+ * @param  {double} budget            : distance budget in miles
+ * @param  {std::vector<double>} dist : per-node distance, all DBL_MAX on entry
+ * @param  {std::vector<int>} order   : settled node indices, nearest first
+ */
+void TrojanMap::BoundedDijkstra(int source, double budget,
+                                std::vector<double> &dist,
+                                std::vector<int> &order) const {
+  std::priority_queue<std::pair<double, int>,
+                      std::vector<std::pair<double, int>>,
+                      std::greater<std::pair<double, int>>> q;
+  std::vector<int> touched;
+  dist[source] = 0;
+  touched.push_back(source);
+  q.push({0, source});
+  while (!q.empty()) {
+    auto top = q.top();
+    q.pop();
+    int u = top.second;
+    if (top.first > dist[u]) continue;  // stale entry
+    if (top.first > budget) break;
+    order.push_back(u);
+    for (int e = adj_offset[u]; e < adj_offset[u + 1]; e++) {
+      int v = adj_target[e];
+      double nd = top.first + adj_weight[e];
+      if (nd < dist[v]) {
+        if (dist[v] == DBL_MAX) touched.push_back(v);
+        dist[v] = nd;
+        q.push({nd, v});
+      }
+    }
+  }
+  // Nodes that were only discovered keep DBL_MAX so dist marks exactly the
+  // settled set.
+  for (int v : touched) {
+    if (dist[v] > budget) dist[v] = DBL_MAX;
+  }
+}
+
+// Cross product of (b - a) x (c - a) on (lat, lon) points.
+static double Cross(const std::pair<double, double> &a,
+                    const std::pair<double, double> &b,
+                    const std::pair<double, double> &c) {
+  return (b.first - a.first) * (c.second - a.second) -
+         (b.second - a.second) * (c.first - a.first);
+}
+
+// Andrew's monotone chain convex hull, counter-clockwise.
+static std::vector<std::pair<double, double>> ConvexHull(
+    std::vector<std::pair<double, double>> points) {
+  std::sort(points.begin(), points.end());
+  points.erase(std::unique(points.begin(), points.end()), points.end());
+  if (points.size() < 3) return points;
+  std::vector<std::pair<double, double>> hull(2 * points.size());
+  size_t k = 0;
+  for (size_t i = 0; i < points.size(); i++) {
+    while (k >= 2 && Cross(hull[k - 2], hull[k - 1], points[i]) <= 0) k--;
+    hull[k++] = points[i];
+  }
+  for (size_t i = points.size() - 1, t = k + 1; i > 0; i--) {
+    while (k >= t && Cross(hull[k - 2], hull[k - 1], points[i - 1]) <= 0) k--;
+    hull[k++] = points[i - 1];
+  }
+  hull.resize(k - 1);
+  return hull;
+}
+
+/**
+ * Isochrone: Return every node reachable from source within budget miles of
+ * road, the edges that cross the budget and the outline of the area. The
+ * outline is the convex hull of the reached nodes plus the points where the
+ * boundary edges run out of budget. An unknown source gives an empty result.
+ *
+ * @param  {std::string} source : source location id
+ * @param  {double} budget      : distance budget in miles
+ * @return {IsochroneResult}    : reached nodes, boundary edges and polygon
+ */
+IsochroneResult TrojanMap::Isochrone(const std::string &source,
+                                     double budget) {
+  std::vector<std::string> sources = {source};
+  return Isochrones(sources, budget, 1)[0];
+}
+
+/**
+ * Isochrones: Isochrone for each source. Each worker thread keeps its own
+ * distance array, so the graph is only read.
+ *
+ * @param  {std::vector<std::string>} sources : source location ids
+ * @param  {double} budget                    : distance budget in miles
+ * @param  {int} num_threads                  : 0 = hardware concurrency
+ * @return {std::vector<IsochroneResult>}     : one result per source
+ */
+std::vector<IsochroneResult> TrojanMap::Isochrones(
+    const std::vector<std::string> &sources, double budget, int num_threads) {
+  std::vector<IsochroneResult> results(sources.size());
+  if (num_threads <= 0) num_threads = std::thread::hardware_concurrency();
+  if (num_threads <= 0) num_threads = 1;
+  std::vector<std::vector<double>> dists(
+      std::min<size_t>(num_threads, std::max<size_t>(sources.size(), 1)));
+
+  ParallelFor(sources.size(), dists.size(), [&](size_t i, int worker) {
+    IsochroneResult &result = results[i];
+    result.source = sources[i];
+    result.budget = budget;
+    auto it = id_to_index.find(sources[i]);
+    if (it == id_to_index.end() || budget < 0) return;
+
+    std::vector<double> &dist = dists[worker];
+    if (dist.empty()) dist.assign(index_to_id.size(), DBL_MAX);
+    std::vector<int> order;
+    BoundedDijkstra(it->second, budget, dist, order);
+
+    std::vector<std::pair<double, double>> outline;
+    result.reached.reserve(order.size());
+    for (int u : order) {
+      result.reached.push_back({index_to_id[u], dist[u]});
+      outline.push_back({node_lat[u], node_lon[u]});
+      for (int e = adj_offset[u]; e < adj_offset[u + 1]; e++) {
+        int v = adj_target[e];
+        if (dist[v] != DBL_MAX) continue;
+        result.boundary_edges.push_back({index_to_id[u], index_to_id[v]});
+        double t = (budget - dist[u]) / adj_weight[e];
+        outline.push_back({node_lat[u] + t * (node_lat[v] - node_lat[u]),
+                           node_lon[u] + t * (node_lon[v] - node_lon[u])});
+      }
+    }
+    result.polygon = ConvexHull(outline);
+    for (int u : order) dist[u] = DBL_MAX;
+  });
+  return results;
+}
+
+/**
+ * CategoryIsochrones: Isochrone for every location of the given category,
+ * e.g. the coverage of every "bank" within one mile.
+ *
+ * @param  {std::string} category         : attribute name
+ * @param  {double} budget                : distance budget in miles
+ * @param  {int} num_threads              : 0 = hardware concurrency
+ * @return {std::vector<IsochroneResult>} : one result per location
+ */
+std::vector<IsochroneResult> TrojanMap::CategoryIsochrones(
+    const std::string &category, double budget, int num_threads) {
+  std::vector<std::string> sources;
+  auto it = category_index.find(category);
+  if (it != category_index.end()) {
+    for (int i : it->second) sources.push_back(index_to_id[i]);
+  }
+  return Isochrones(sources, budget, num_threads);
+}
+
+/**
+ * BuildNearestFacilityTable: Seed a Dijkstra with every location of the
+ * category at distance 0 and let each settled node inherit the label of the
+ * node it was reached from. One O(E log V) pass labels the whole map, after
+ * which NearestFacility is a table lookup.
+ *
+ * @param  {std::string} category     : attribute name
+ * @return {NearestFacilityTable}     : labels for every node index
+ */
+const NearestFacilityTable &TrojanMap::BuildNearestFacilityTable(
+    const std::string &category) {
+  auto cached = facility_tables.find(category);
+  if (cached != facility_tables.end()) return cached->second;
+
+  NearestFacilityTable table;
+  table.category = category;
+  auto it = category_index.find(category);
+  if (it != category_index.end()) table.facilities = it->second;
+  int n = index_to_id.size();
+  table.nearest.assign(n, -1);
+  table.distance.assign(n, DBL_MAX);
+
+  std::priority_queue<std::pair<double, int>,
+                      std::vector<std::pair<double, int>>,
+                      std::greater<std::pair<double, int>>> q;
+  for (int f = 0; f < int(table.facilities.size()); f++) {
+    int u = table.facilities[f];
+    table.nearest[u] = f;
+    table.distance[u] = 0;
+    q.push({0, u});
+  }
+  while (!q.empty()) {
+    auto top = q.top();
+    q.pop();
+    int u = top.second;
+    if (top.first > table.distance[u]) continue;  // stale entry
+    for (int e = adj_offset[u]; e < adj_offset[u + 1]; e++) {
+      int v = adj_target[e];
+      double nd = top.first + adj_weight[e];
+      if (nd < table.distance[v]) {
+        table.distance[v] = nd;
+        table.nearest[v] = table.nearest[u];
+        q.push({nd, v});
+      }
+    }
+  }
+  return facility_tables[category] = std::move(table);
+}
+
+/**
+ * NearestFacility: Given a category and a location id, return the closest
+ * location of that category along the roads.
+ *
+ * @param  {std::string} category          : attribute name
+ * @param  {std::string} id                : location id
+ * @return {std::pair<std::string,double>} : (facility id, miles)
+ */
+std::pair<std::string, double> TrojanMap::NearestFacility(
+    const std::string &category, const std::string &id) {
+  std::pair<std::string, double> result("", -1);
+  auto it = id_to_index.find(id);
+  if (it == id_to_index.end()) return result;
+  const NearestFacilityTable &table = BuildNearestFacilityTable(category);
+  int f = table.nearest[it->second];
+  if (f < 0) return result;
+  result.first = index_to_id[table.facilities[f]];
+  result.second = table.distance[it->second];
+  return result;
+}
+
+std::shared_ptr<const DistanceMatrix> RoadMatrixCache::Find(
+    const std::string &key) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = index.find(key);
+  if (it == index.end()) return nullptr;
+  entries.splice(entries.begin(), entries, it->second);
+  return it->second->second;
+}
+
+void RoadMatrixCache::Insert(const std::string &key,
+                             std::shared_ptr<const DistanceMatrix> matrix) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = index.find(key);
+  if (it != index.end()) {
+    entries.erase(it->second);
+    index.erase(it);
+  }
+  entries.emplace_front(key, std::move(matrix));
+  index[key] = entries.begin();
+  while (entries.size() > capacity) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+  }
+}
+
+void RoadMatrixCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  entries.clear();
+  index.clear();
+}
+
+size_t RoadMatrixCache::Size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return entries.size();
+}
+
+/**
+ * BuildRoadDistanceMatrix: Run a Dijkstra from every stop that stops as soon
+ * as all the other stops are settled. Sources are independent, so each
+ * worker thread keeps its own distance array. The matrix is computed and
+ * cached for the sorted set of stops, and its rows and columns are then put
+ * in the order of location_ids, so any order of the same stops skips the
+ * searches.
+ *
+ * @param  {std::vector<std::string>} location_ids : stops
+ * @param  {int} num_threads                       : 0 = hardware concurrency
+ * @return {DistanceMatrix}                        : road distances in miles
+ */
+DistanceMatrix TrojanMap::BuildRoadDistanceMatrix(
+    const std::vector<std::string> &location_ids, int num_threads) {
+  std::vector<std::string> ids = location_ids;
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  std::string key;
+  for (auto &id : ids) key += id + ",";
+
+  std::shared_ptr<const DistanceMatrix> cached = road_matrix_cache.Find(key);
+  if (!cached) {
+    const double kUnreachable = 1e6;
+    int n = ids.size();
+    std::vector<int> stop(n, -1);
+    std::unordered_map<int, int> stop_at;  // node -> stop index
+    for (int i = 0; i < n; i++) {
+      auto it = id_to_index.find(ids[i]);
+      if (it == id_to_index.end()) continue;
+      stop[i] = it->second;
+      stop_at[stop[i]] = i;
+    }
+    // A search only has to settle the stops in its own component; the rest
+    // stay unreachable.
+    bool connected = connectivity.component.size() == index_to_id.size();
+    std::unordered_map<int, size_t> stops_in_component;
+    for (auto &at : stop_at) {
+      stops_in_component[connected ? connectivity.component[at.first] : 0]++;
+    }
+
+    auto matrix = std::make_shared<DistanceMatrix>(n);
+    for (auto &d : matrix->dist) d = kUnreachable;
+    if (num_threads <= 0) num_threads = std::thread::hardware_concurrency();
+    if (num_threads <= 0) num_threads = 1;
+    std::vector<std::vector<double>> dists(
+        std::min(num_threads, std::max(n, 1)));
+
+    ParallelFor(n, dists.size(), [&](size_t i, int worker) {
+      (*matrix)(i, i) = 0;
+      if (stop[i] < 0) return;
+      std::vector<double> &dist = dists[worker];
+      if (dist.empty()) dist.assign(index_to_id.size(), DBL_MAX);
+      std::vector<int> touched = {stop[i]};
+      size_t remaining = stops_in_component.at(
+          connected ? connectivity.component[stop[i]] : 0);
+      std::priority_queue<std::pair<double, int>,
+                          std::vector<std::pair<double, int>>,
+                          std::greater<std::pair<double, int>>> q;
+      dist[stop[i]] = 0;
+      q.push({0, stop[i]});
+      while (!q.empty() && remaining > 0) {
+        auto top = q.top();
+        q.pop();
+        int u = top.second;
+        if (top.first > dist[u]) continue;  // stale entry
+        auto at = stop_at.find(u);
+        if (at != stop_at.end()) {
+          (*matrix)(i, at->second) = top.first;
+          remaining--;
+        }
+        for (int e = adj_offset[u]; e < adj_offset[u + 1]; e++) {
+          int v = adj_target[e];
+          double nd = top.first + adj_weight[e];
+          if (nd < dist[v]) {
+            if (dist[v] == DBL_MAX) touched.push_back(v);
+            dist[v] = nd;
+            q.push({nd, v});
+          }
+        }
+      }
+      for (int v : touched) dist[v] = DBL_MAX;
+    });
+    cached = matrix;
+    road_matrix_cache.Insert(key, cached);
+  }
+
+  int n = location_ids.size();
+  std::vector<int> slot(n);
+  for (int i = 0; i < n; i++) {
+    slot[i] = std::lower_bound(ids.begin(), ids.end(), location_ids[i]) -
+              ids.begin();
+  }
+  DistanceMatrix matrix(n);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) matrix(i, j) = (*cached)(slot[i], slot[j]);
+  }
+  return matrix;
+}
+
+/**
+ * RoadPath: Dijkstra between two node indices that stops at the goal.
+ *
+ * @param  {int} from          : start node index
+ * @param  {int} to            : goal node index
+ * @return {std::vector<int>}  : node indices from start to goal
+ */
+std::vector<int> TrojanMap::RoadPath(int from, int to) const {
+  std::vector<double> dist(index_to_id.size(), DBL_MAX);
+  std::vector<int> prev(index_to_id.size(), -1);
+  std::priority_queue<std::pair<double, int>,
+                      std::vector<std::pair<double, int>>,
+                      std::greater<std::pair<double, int>>> q;
+  dist[from] = 0;
+  q.push({0, from});
+  while (!q.empty()) {
+    auto top = q.top();
+    q.pop();
+    int u = top.second;
+    if (top.first > dist[u]) continue;
+    if (u == to) break;
+    for (int e = adj_offset[u]; e < adj_offset[u + 1]; e++) {
+      int v = adj_target[e];
+      if (top.first + adj_weight[e] < dist[v]) {
+        dist[v] = top.first + adj_weight[e];
+        prev[v] = u;
+        q.push({dist[v], v});
+      }
+    }
+  }
+  std::vector<int> path;
+  if (dist[to] == DBL_MAX) return path;
+  for (int v = to; v != -1; v = prev[v]) path.push_back(v);
+  std::reverse(path.begin(), path.end());
+  return path;
+}
+
+/**
+ * TravelingTrojan_Road: Solve the TSP on road distances rather than straight
+ * lines, then expand each leg of the final tour into its road path. No tour
+ * exists when a stop is unknown or cut off from the others by the road
+ * network, and the result is empty then.
+ *
+ * @param  {std::vector<std::string>} input : a list of locations needs to visit
+ * @param  {TSPSolver} solver               : solver to run on the matrix
+ * @param  {std::vector<std::string>*} road_path : every node of the final tour
+ * @param  {QueryContext*} ctx              : passed on to the solver
+ * @return {std::pair<double, std::vector<std::vector<std::string>>>} : a pair of
+ * total road distance and the all the progress to get final path
+ */
+std::pair<double, std::vector<std::vector<std::string>>>
+TrojanMap::TravelingTrojan_Road(std::vector<std::string> location_ids,
+                                TSPSolver solver,
+                                std::vector<std::string> *road_path,
+                                QueryContext *ctx) {
+  if (road_path) road_path->clear();
+  for (auto &id : location_ids) {
+    if (!IsReachable(location_ids[0], id)) return {0, {}};
+  }
+  auto result = TourProgressToIds(
+      location_ids, TSP_Solve(BuildRoadDistanceMatrix(location_ids), solver,
+                              1000, ctx));
+  if (road_path && !result.second.empty()) {
+    auto &tour = result.second.back();
+    for (int i = 0; i + 1 < int(tour.size()); i++) {
+      std::vector<int> leg =
+          RoadPath(id_to_index.at(tour[i]), id_to_index.at(tour[i + 1]));
+      for (int j = road_path->empty() ? 0 : 1; j < int(leg.size()); j++) {
+        road_path->push_back(index_to_id[leg[j]]);
+      }
+    }
+  }
+  return result;
+}
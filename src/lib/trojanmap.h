@@ -4,18 +4,28 @@
 #include <math.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cfloat>
+#include <chrono>
 #include <climits>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <queue>
 #include <regex>
 #include <sstream>
 #include <stack>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 // #include <boost/algorithm/string/predicate.hpp>
 // #include <boost/algorithm/string.hpp>
@@ -32,6 +42,9 @@ class Node {
     neighbors = n.neighbors;
     attributes = n.attributes;
   };
+  Node(Node &&n) = default;
+  Node &operator=(const Node &n) = default;
+  Node &operator=(Node &&n) = default;
   std::string id;    // A unique id assign to each point
   double lat;        // Latitude
   double lon;        // Longitude
@@ -42,17 +55,317 @@ class Node {
       attributes;  // List of the attributes of the location.
 };
 
+// The area reachable from one source within a road distance budget.
+class IsochroneResult {
+ public:
+  std::string source;  // id of the source node
+  double budget = 0;   // distance budget in miles
+  // Reached node ids with their road distance from source, nearest first.
+  std::vector<std::pair<std::string, double>> reached;
+  // Edges (u, v) where u is within the budget and v is not.
+  std::vector<std::pair<std::string, std::string>> boundary_edges;
+  // Convex hull (lat, lon) of the reached area, counter-clockwise.
+  std::vector<std::pair<double, double>> polygon;
+};
+
+// The nearest location of one category, by road, for every node of the map.
+class NearestFacilityTable {
+ public:
+  std::string category;
+  std::vector<int> facilities;  // node indices of the category's locations
+  // Per node index: position in facilities of the nearest one (-1 when none
+  // is reachable) and the road distance to it in miles.
+  std::vector<int> nearest;
+  std::vector<double> distance;
+};
+
+// What AnalyzeRegions found inside one rectangle.
+class RegionReport {
+ public:
+  int nodes = 0;       // locations inside, as GetSubgraph would return
+  int edges = 0;       // roads with both ends inside
+  int components = 0;  // connected pieces of that subgraph
+  bool has_cycle = false;  // what CycleDetection would return
+};
+
+// Connectivity of the road graph over the dense node indices, built once by
+// BuildConnectivity().
+class Connectivity {
+ public:
+  std::vector<int> component;  // connected component of every node
+  int num_components = 0;
+  // Roads whose removal disconnects their ends, as (u, v) with u < v.
+  std::vector<std::pair<int, int>> bridges;
+  // Nodes whose removal disconnects their component, ascending.
+  std::vector<int> articulation_points;
+  // Biconnected blocks as sorted node lists; a bridge is a block of two.
+  std::vector<std::vector<int>> blocks;
+};
+
+// Row-major matrix of distances between a list of stops. TSP solvers work on
+// indices into this matrix; a tour lists indices and ends back at its start.
+class DistanceMatrix {
+ public:
+  DistanceMatrix(){};
+  DistanceMatrix(int size) : n(size), dist(size * size, 0){};
+  int n = 0;
+  std::vector<double> dist;
+  double operator()(int i, int j) const { return dist[i * n + j]; }
+  double &operator()(int i, int j) { return dist[i * n + j]; }
+};
+
+// Road distance matrices for BuildRoadDistanceMatrix(), keyed by the sorted
+// set of stop ids so any order of the same stops hits. Keeps the capacity
+// most recently used sets. Thread-safe.
+class RoadMatrixCache {
+ public:
+  RoadMatrixCache(size_t capacity = 32) : capacity(capacity){};
+
+  // The matrix stored under key, or nullptr.
+  std::shared_ptr<const DistanceMatrix> Find(const std::string &key);
+  void Insert(const std::string &key,
+              std::shared_ptr<const DistanceMatrix> matrix);
+  void Clear();
+  size_t Size() const;
+
+ private:
+  typedef std::pair<std::string, std::shared_ptr<const DistanceMatrix>> Entry;
+  size_t capacity;
+  mutable std::mutex mutex;
+  std::list<Entry> entries;  // most recently used first
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+};
+
+// Matrix-based TSP solvers that TSP_Solve can dispatch to.
+enum class TSPSolver {
+  kHeldKarp,
+  kBranchAndBound,
+  kParallel,
+  k2opt,
+  k3opt,
+  kLinKernighan,
+  kMultiStart
+};
+
+// Tour construction heuristics used to seed local search.
+enum class TourSeed {
+  kInputOrder,
+  kNearestNeighbor,
+  kGreedyEdge,
+  kChristofides,
+  kSpaceFillingCurve
+};
+
+// Progress of a TSP solver recorded as moves instead of full tours: the
+// first tour, then the reversed slices of the tour array (2 ints each) and
+// whole-tour snapshots, with frame marks between them. Once more than
+// capacity ints are stored the oldest entries are folded into the base tour,
+// so memory stays O(n + capacity) however long the solver runs. Subscribers
+// see every frame as it is recorded; Replay rebuilds them afterwards.
+class TSPProgress {
+ public:
+  TSPProgress(size_t capacity = 1 << 20) : capacity(capacity){};
+
+  // Start a recording from this order of matrix indices (the first frame).
+  void Reset(const std::vector<int> &tour);
+  // The cyclic slice of len positions starting at position i was reversed.
+  void Reverse(int i, int len);
+  // The tour was replaced as a whole.
+  void Snapshot(const std::vector<int> &tour);
+  // End the current frame and pass it to the subscribers.
+  void Frame();
+  // Call fn with every frame still held, oldest first.
+  void Replay(
+      const std::function<void(const std::vector<int> &)> &fn) const;
+  // Call fn with every frame recorded from now on.
+  void Subscribe(std::function<void(const std::vector<int> &)> fn);
+
+  // Frames Replay will produce, and frames folded away to bound memory.
+  size_t FrameCount() const { return base.empty() ? 0 : 1 + frame_marks; }
+  size_t dropped_frames = 0;
+
+  // A frame as a closed tour of matrix indices starting and ending at 0.
+  static std::vector<int> Closed(const std::vector<int> &tour);
+
+  // Ints of moves and snapshots kept. The frame in progress may take up to
+  // twice the size of a tour beyond it.
+  size_t capacity;
+
+ private:
+  void Apply(std::vector<int> &tour, int i, int len) const;
+  void Fold();
+
+  // Entry kinds in moves: {i, len} reversal, {kFrame, 0} frame mark and
+  // {kSnapshot, 0} for the next tour in snapshots.
+  static constexpr int kFrame = -1;
+  static constexpr int kSnapshot = -2;
+  std::vector<int> base;     // tour before the first stored move
+  std::vector<int> current;  // tour after the last stored move
+  std::deque<std::pair<int, int>> moves;
+  std::deque<std::vector<int>> snapshots;
+  size_t stored = 0;
+  size_t frame_marks = 0;
+  std::vector<std::function<void(const std::vector<int> &)>> subscribers;
+};
+
+// Zero-copy reader of comma-separated files. The file is memory-mapped and
+// every field is a string_view into it, trimmed of surrounding blanks.
+// Double-quoted fields may hold commas, line breaks and "" for a quote; one
+// with "" is unescaped into scratch space that lives until the next row.
+// Blank lines are skipped and lines may end in \n or \r\n.
+class CSVReader {
+ public:
+  CSVReader(const std::string &filename);
+  ~CSVReader();
+  CSVReader(const CSVReader &) = delete;
+  CSVReader &operator=(const CSVReader &) = delete;
+
+  // Whether the file could be read.
+  bool ok() const { return ok_; }
+
+  // Call fn with the fields of every row, the header row included only if
+  // skip_header is false. Stops early when fn returns false.
+  void ForEachRow(
+      const std::function<bool(const std::vector<std::string_view> &)> &fn,
+      bool skip_header = true);
+
+  // Tokenize every row of text, which must start at the start of a row.
+  // Works on any buffer, e.g. one chunk of a file.
+  static void ForEachRow(
+      std::string_view text,
+      const std::function<bool(const std::vector<std::string_view> &)> &fn);
+
+  // The whole file.
+  std::string_view contents() const { return {base_, size_}; }
+
+ private:
+  const char *base_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  bool ok_ = false;
+  std::string buffer_;  // file contents when mmap is not possible
+};
+
+// Delivery dependencies over interned location names. Node i is names[i],
+// and names are sorted, so a smaller index is a smaller name. Its
+// successors are target[offset[i]] .. target[offset[i + 1] - 1].
+class DependencyGraph {
+ public:
+  std::vector<std::string> names;
+  std::unordered_map<std::string, int> index;
+  std::vector<int> offset;
+  std::vector<int> target;
+  std::vector<int> indegree;
+};
+
+// Deliveries grouped by dependency depth. Level 0 has no prerequisites and
+// every other location sits one level after its latest prerequisite, so the
+// locations of one level can be delivered at the same time.
+class DeliveryLevels {
+ public:
+  std::vector<std::vector<std::string>> levels;  // names sorted per level
+  // Longest chain of dependent deliveries; its length is levels.size().
+  std::vector<std::string> critical_path;
+  // With k couriers and one step per delivery: schedule[t] lists what the
+  // couriers deliver in step t, courier c taking schedule[t][c].
+  std::vector<std::vector<std::string>> schedule;
+  // Locations along a dependency cycle; everything else is empty then.
+  std::vector<std::string> cycle;
+};
+
+// How a query run under a QueryContext ended.
+enum class QueryStatus {
+  kComplete,  // ran to the end
+  kPartial,   // anytime solver stopped early; the result is its best so far
+  kTimeout,   // exact algorithm stopped early; the result is empty
+  kTooLarge   // exact algorithm refused the input as too large; empty result
+};
+
+// Deadline and cancellation token for long-running queries. Pass a pointer to
+// the query and call Cancel() from any thread to stop it. Algorithms check it
+// in their hot loops and record how they ended in status.
+class QueryContext {
+ public:
+  QueryContext(){};
+  // A context whose deadline is timeout_ms from now.
+  QueryContext(double timeout_ms)
+      : deadline(std::chrono::steady_clock::now() +
+                 std::chrono::microseconds(int64_t(timeout_ms * 1000))){};
+
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::time_point::max();
+  std::atomic<bool> cancelled{false};
+  QueryStatus status = QueryStatus::kComplete;
+
+  void Cancel() { cancelled = true; }
+
+  // Whether the query should stop. Thread-safe; reads the clock.
+  bool Expired() const {
+    return cancelled.load(std::memory_order_relaxed) ||
+           std::chrono::steady_clock::now() >= deadline;
+  }
+
+  // Expired() for hot loops on the querying thread: the real check runs on
+  // the first and then every 1024th call, and once true it stays true.
+  bool Poll() {
+    if (!stopped && ++ticks % 1024 == 0) stopped = Expired();
+    return stopped;
+  }
+  bool Stopped() const { return stopped; }
+
+ private:
+  unsigned ticks = 1023;
+  bool stopped = false;
+};
+
 class TrojanMap {
  public:
   // Constructor
-  TrojanMap() { CreateGraphFromCSVFile(); };
+  TrojanMap() { LoadMap(); };
 
   // A map of ids to Nodes.
   std::unordered_map<std::string, Node> data;
 
+  // Dense integer view of `data` built by BuildGraphIndex(). Node i has id
+  // index_to_id[i] and its neighbors are adj_target[adj_offset[i]] ..
+  // adj_target[adj_offset[i + 1] - 1], with edge lengths in adj_weight.
+  std::vector<std::string> index_to_id;
+  std::unordered_map<std::string, int> id_to_index;
+  std::vector<double> node_lat;
+  std::vector<double> node_lon;
+  std::vector<int> adj_offset;
+  std::vector<int> adj_target;
+  std::vector<double> adj_weight;
+  // Node indices of every location carrying a given attribute.
+  std::unordered_map<std::string, std::vector<int>> category_index;
+  // Tables built by BuildNearestFacilityTable(), keyed by category.
+  std::unordered_map<std::string, NearestFacilityTable> facility_tables;
+  // Matrices built by BuildRoadDistanceMatrix().
+  RoadMatrixCache road_matrix_cache;
+  // Components, bridges and blocks of the dense graph.
+  Connectivity connectivity;
+
   //-----------------------------------------------------
-  // Read in the data
-  void CreateGraphFromCSVFile();
+  // Replace the map with the one in filename and rebuild everything derived
+  // from it: the dense index, connectivity and the cached tables. Parses on
+  // up to num_threads threads (0 = one per hardware thread).
+  void LoadMap(const std::string &filename = "src/lib/data.csv",
+               int num_threads = 0);
+
+  // Parse the map CSV and merge its rows into `data`. Only the first step of
+  // LoadMap; nothing derived from `data` is updated.
+  void CreateGraphFromCSVFile(const std::string &filename = "src/lib/data.csv",
+                              int num_threads = 0);
+
+  // Build the dense index above from `data`, dropping the cached tables that
+  // refer to the old one.
+  void BuildGraphIndex();
+
+  // Fill `connectivity` from the dense index. O(V + E).
+  void BuildConnectivity();
+
+  // Whether there is any road path between two location ids. O(1).
+  bool IsReachable(const std::string &id1, const std::string &id2) const;
 
   //-----------------------------------------------------
   // TODO: Implement these functions and create unit tests for them:
@@ -99,10 +412,14 @@ class TrojanMap {
 
   // Given the name of two locations, it should return the **ids** of the nodes
   // on the shortest path.
+  // Queries that take a QueryContext stop when it expires; see QueryStatus
+  // for what they return then.
   std::vector<std::string> CalculateShortestPath_Dijkstra(
-      std::string location1_name, std::string location2_name);
+      std::string location1_name, std::string location2_name,
+      QueryContext *ctx = nullptr);
   std::vector<std::string> CalculateShortestPath_Bellman_Ford(
-      std::string location1_name, std::string location2_name);
+      std::string location1_name, std::string location2_name,
+      QueryContext *ctx = nullptr);
 
   // Given CSV filename, it read and parse locations data from CSV file,
   // and return locations vector for topological sort problem.
@@ -115,10 +432,54 @@ class TrojanMap {
       std::string dependencies_filename);
 
   // Given a vector of location names, it should return a sorting of nodes
-  // that satisfies the given dependencies.
+  // that satisfies the given dependencies. Ties go to the smallest name. If
+  // the dependencies have a cycle the result is empty and cycle, if given,
+  // receives the names along one of them.
   std::vector<std::string> DeliveringTrojan(
       std::vector<std::string> &location_names,
-      std::vector<std::vector<std::string>> &dependencies);
+      std::vector<std::vector<std::string>> &dependencies,
+      std::vector<std::string> *cycle = nullptr);
+
+  // Split the deliveries into levels of mutually independent locations and
+  // find the critical path. With couriers > 0, also list-schedule them on
+  // that many couriers, longest remaining chain first.
+  DeliveryLevels DeliveringTrojanLevels(
+      const std::vector<std::string> &location_names,
+      const std::vector<std::vector<std::string>> &dependencies,
+      int couriers = 0);
+
+  // Shortest open route through the named locations that reaches every one
+  // after all of its prerequisites: exact up to kMaxPrecedenceExact
+  // locations, constrained Or-opt local search beyond. Names are resolved
+  // with GetID. (-1, {}) if a name is unknown or the dependencies have a
+  // cycle.
+  std::pair<double, std::vector<std::string>> DeliveringTrojanRoute(
+      const std::vector<std::string> &location_names,
+      const std::vector<std::vector<std::string>> &dependencies,
+      QueryContext *ctx = nullptr);
+
+  // Cores of DeliveringTrojanRoute over a matrix indexed like the graph.
+  // They return the route length and the visiting order, or (-1, {}). The
+  // exact one refuses more than kMaxPrecedenceExact locations (kTooLarge).
+  static constexpr int kMaxPrecedenceExact = 16;
+  std::pair<double, std::vector<int>> PrecedenceRoute_Exact(
+      const DistanceMatrix &dist, const DependencyGraph &graph,
+      QueryContext *ctx = nullptr);
+  std::pair<double, std::vector<int>> PrecedenceRoute_LocalSearch(
+      const DistanceMatrix &dist, const DependencyGraph &graph,
+      QueryContext *ctx = nullptr);
+
+  // Intern the locations and add an edge between consecutive names of every
+  // dependency row. Edges that name an unknown location are ignored.
+  DependencyGraph BuildDependencyGraph(
+      const std::vector<std::string> &location_names,
+      const std::vector<std::vector<std::string>> &dependencies);
+
+  // Same, streaming the rows of a dependencies CSV file straight into the
+  // graph without building the rows as strings.
+  DependencyGraph BuildDependencyGraphFromCSVFile(
+      const std::vector<std::string> &location_names,
+      const std::string &dependencies_filename);
 
   // Given a vector of location ids, it should reorder them such that the path
   // that covers all these points has the minimum length.
@@ -131,21 +492,153 @@ class TrojanMap {
                         std::vector<std::string> cur_path, 
                         double &min_cost,
                         std::vector<std::string> &min_path,
-                        std::vector<std::vector<std::string>> &record_list);
+                        std::vector<std::vector<std::string>> &record_list,
+                        QueryContext *ctx = nullptr);
 
   std::pair<double, std::vector<std::vector<std::string>>>
-  TravelingTrojan_Brute_force(std::vector<std::string> location_ids);
+  TravelingTrojan_Brute_force(std::vector<std::string> location_ids,
+                              QueryContext *ctx = nullptr);
   void TravelingTrojan_BT(std::string start,
                         std::vector<std::string> location_ids,
                         std::vector<std::string> cur_path, 
                         double &min_cost,
                         std::vector<std::string> &min_path,
-                        std::vector<std::vector<std::string>> &record_list);
+                        std::vector<std::vector<std::string>> &record_list,
+                        QueryContext *ctx = nullptr);
   std::pair<double, std::vector<std::vector<std::string>>>
-  TravelingTrojan_Backtracking(std::vector<std::string> location_ids);
+  TravelingTrojan_Backtracking(std::vector<std::string> location_ids,
+                               QueryContext *ctx = nullptr);
 
+  // Solvers that take a TSPProgress record into it instead of returning
+  // every intermediate tour; their progress then holds the final tour only.
   std::pair<double, std::vector<std::vector<std::string>>> TravelingTrojan_2opt(
-      std::vector<std::string> location_ids);
+      std::vector<std::string> location_ids,
+      TourSeed seed = TourSeed::kGreedyEdge, TSPProgress *progress = nullptr,
+      QueryContext *ctx = nullptr);
+
+  // Starting order over the matrix built by the given heuristic, beginning
+  // with stop 0. kSpaceFillingCurve needs the (lat, lon) of every stop and
+  // falls back to nearest neighbor without them.
+  std::vector<int> TSP_InitialTour(
+      const DistanceMatrix &dist, TourSeed seed,
+      const std::vector<std::pair<double, double>> &coords = {});
+
+  // (lat, lon) of every location id.
+  std::vector<std::pair<double, double>> GetCoordinates(
+      const std::vector<std::string> &location_ids);
+
+  // 2-opt over the matrix with O(1) move deltas, in-place reversals, the k
+  // nearest neighbors as candidates and don't-look bits.
+  std::pair<double, std::vector<std::vector<int>>> TSP_2opt(
+      const DistanceMatrix &dist, std::vector<int> initial = {}, int k = 10,
+      TSPProgress *progress = nullptr, QueryContext *ctx = nullptr);
+
+  // 2-opt plus Or-opt and segment insertion moves, same engine as TSP_2opt.
+  std::pair<double, std::vector<std::vector<int>>> TSP_3opt(
+      const DistanceMatrix &dist, std::vector<int> initial = {}, int k = 10,
+      TSPProgress *progress = nullptr, QueryContext *ctx = nullptr);
+  std::pair<double, std::vector<std::vector<std::string>>> TravelingTrojan_3opt(
+      std::vector<std::string> location_ids,
+      TourSeed seed = TourSeed::kGreedyEdge, TSPProgress *progress = nullptr,
+      QueryContext *ctx = nullptr);
+
+  // Chained Lin-Kernighan (sequential 2-opt flips up to 6-opt, plus Or-opt)
+  // with double-bridge kicks, returning the best tour found when the time
+  // budget expires or after max_kicks kicks (0 = no limit).
+  std::pair<double, std::vector<std::vector<int>>> TSP_LinKernighan(
+      const DistanceMatrix &dist, double time_budget_ms,
+      std::vector<int> initial = {}, int k = 8,
+      TSPProgress *progress = nullptr, int max_kicks = 0,
+      QueryContext *ctx = nullptr);
+  std::pair<double, std::vector<std::vector<std::string>>>
+  TravelingTrojan_LinKernighan(std::vector<std::string> location_ids,
+                               double time_budget_ms = 1000,
+                               TSPProgress *progress = nullptr,
+                               int max_kicks = 0, QueryContext *ctx = nullptr);
+
+  // Parallel multi-start iterated local search that shares the global best
+  // tour between epochs. Seedable; see trojanmap.cc for reproducibility.
+  std::pair<double, std::vector<std::vector<int>>> TSP_MultiStart(
+      const DistanceMatrix &dist, double time_budget_ms, int num_chains = 0,
+      unsigned seed = 0, int max_epochs = 0, QueryContext *ctx = nullptr);
+  std::pair<double, std::vector<std::vector<std::string>>>
+  TravelingTrojan_MultiStart(std::vector<std::string> location_ids,
+                             double time_budget_ms = 1000, int num_chains = 0,
+                             unsigned seed = 0, int max_epochs = 0,
+                             QueryContext *ctx = nullptr);
+
+  // Run the chosen solver on a matrix. Time-budgeted solvers get
+  // time_budget_ms. The exact solvers keep their size limits.
+  std::pair<double, std::vector<std::vector<int>>> TSP_Solve(
+      const DistanceMatrix &dist, TSPSolver solver,
+      double time_budget_ms = 1000, QueryContext *ctx = nullptr);
+
+  // Shortest road distance between every pair of the given locations, one
+  // Dijkstra per stop spread over num_threads threads. Cached per stop set.
+  // Pairs with no road between them get a prohibitive 1e6 miles.
+  DistanceMatrix BuildRoadDistanceMatrix(
+      const std::vector<std::string> &location_ids, int num_threads = 0);
+
+  // Node indices of the shortest road path between two node indices, empty
+  // when there is none.
+  std::vector<int> RoadPath(int from, int to) const;
+
+  // TSP scored by road distance. Progress lists the stop orders; road_path,
+  // if given, receives the final tour expanded into every node on the road.
+  // Empty when some stop cannot be reached by road from the others.
+  std::pair<double, std::vector<std::vector<std::string>>> TravelingTrojan_Road(
+      std::vector<std::string> location_ids,
+      TSPSolver solver = TSPSolver::k3opt,
+      std::vector<std::string> *road_path = nullptr,
+      QueryContext *ctx = nullptr);
+
+  // Straight-line distances between the given locations.
+  DistanceMatrix BuildDistanceMatrix(
+      const std::vector<std::string> &location_ids);
+
+  // Length of a closed tour of matrix indices.
+  static double TourLength(const DistanceMatrix &dist,
+                           const std::vector<int> &tour);
+
+  // Map the index tours of a matrix solver back to location ids.
+  static std::pair<double, std::vector<std::vector<std::string>>>
+  TourProgressToIds(
+      const std::vector<std::string> &location_ids,
+      const std::pair<double, std::vector<std::vector<int>>> &progress);
+
+  // Largest inputs of the exact solvers. Past these they return an empty
+  // result with QueryStatus::kTooLarge instead of a heuristic tour.
+  static constexpr int kMaxHeldKarpStops = 21;
+  static constexpr int kMaxBranchAndBoundStops = 64;
+
+  // Exact Held-Karp dynamic programming over the matrix. Layers of equal
+  // subset size are filled by num_threads threads (0 = hardware concurrency).
+  std::pair<double, std::vector<std::vector<int>>> TSP_HeldKarp(
+      const DistanceMatrix &dist, int num_threads = 0,
+      QueryContext *ctx = nullptr);
+  std::pair<double, std::vector<std::vector<std::string>>>
+  TravelingTrojan_HeldKarp(std::vector<std::string> location_ids,
+                           QueryContext *ctx = nullptr);
+
+  // Exact branch and bound: incremental path cost, MST lower bound on the
+  // unvisited stops, nearest-first children and a bitmask visited set.
+  std::pair<double, std::vector<std::vector<int>>> TSP_BranchAndBound(
+      const DistanceMatrix &dist, QueryContext *ctx = nullptr);
+  std::pair<double, std::vector<std::vector<std::string>>>
+  TravelingTrojan_BranchAndBound(std::vector<std::string> location_ids,
+                                 QueryContext *ctx = nullptr);
+
+  // Exact search split into one task per path prefix of split_depth stops
+  // after the start. Tasks run on a work-stealing pool of num_threads threads
+  // (0 = hardware concurrency) that prune against a shared atomic incumbent.
+  // The chosen tour does not depend on scheduling.
+  std::pair<double, std::vector<std::vector<int>>> TSP_Parallel(
+      const DistanceMatrix &dist, int split_depth = 2, int num_threads = 0,
+      QueryContext *ctx = nullptr);
+  std::pair<double, std::vector<std::vector<std::string>>>
+  TravelingTrojan_Parallel(std::vector<std::string> location_ids,
+                           int split_depth = 2, int num_threads = 0,
+                           QueryContext *ctx = nullptr);
 
   // Check whether the id is in square or not
   bool inSquare(std::string id, std::vector<double> &square);
@@ -154,14 +647,53 @@ class TrojanMap {
   std::vector<std::string> GetSubgraph(std::vector<double> &square);
 
   // Given a subgraph specified by a square-shape area, determine whether there
-  // is a cycle or not in this subgraph.
+  // is a cycle or not in this subgraph. If cycle is given it receives the ids
+  // along one cycle, e.g. for PlotPointsandEdges.
   bool CycleDetection(std::vector<std::string> &subgraph,
-                      std::vector<double> &square);
+                      std::vector<double> &square,
+                      std::vector<std::string> *cycle = nullptr);
+
+  // GetSubgraph and CycleDetection for many squares at once. The nodes are
+  // bucketed into a grid once and the squares are spread over num_threads
+  // threads (0 = one per hardware thread). If subgraphs is given it receives
+  // the ids inside each square.
+  std::vector<RegionReport> AnalyzeRegions(
+      const std::vector<std::vector<double>> &squares, int num_threads = 0,
+      std::vector<std::vector<std::string>> *subgraphs = nullptr);
 
   // Given a location id and k, find the k closest points on the map
   std::vector<std::string> FindNearby(std::string, std::string, double, int);
 
   //----------------------------------------------------- User-defined functions
+  // Run Dijkstra from a node index, settling only nodes within budget miles.
+  // dist must have one entry per node and be all DBL_MAX on entry; settled
+  // indices are appended to order in the order they were settled.
+  void BoundedDijkstra(int source, double budget, std::vector<double> &dist,
+                       std::vector<int> &order) const;
+
+  // Return everything reachable from the source id within budget miles.
+  IsochroneResult Isochrone(const std::string &source, double budget);
+
+  // Isochrone for many sources, spread over num_threads threads
+  // (0 = one per hardware thread).
+  std::vector<IsochroneResult> Isochrones(
+      const std::vector<std::string> &sources, double budget,
+      int num_threads = 0);
+
+  // Isochrone for every location of a category.
+  std::vector<IsochroneResult> CategoryIsochrones(const std::string &category,
+                                                  double budget,
+                                                  int num_threads = 0);
+
+  // Label every node with its nearest location of the category using one
+  // multi-source Dijkstra. The table is cached in facility_tables.
+  const NearestFacilityTable &BuildNearestFacilityTable(
+      const std::string &category);
+
+  // Return the id of the location of the category closest by road to the
+  // given id, and its distance. ("", -1) if there is none.
+  std::pair<std::string, double> NearestFacility(const std::string &category,
+                                                 const std::string &id);
 };
 
 #endif
@@ -0,0 +1,70 @@
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "src/lib/maprenderer.h"
+
+// Test the image size and the colour of a drawn stop
+TEST(MapRendererTest, RenderPoints) {
+  TrojanMap m;
+  MapRenderer r(m);
+  Viewport png;
+  std::string ralphs = m.GetID("Ralphs");
+  cv::Mat img = r.RenderPoints({ralphs});
+  EXPECT_EQ(img.cols, png.width);
+  EXPECT_EQ(img.rows, png.height);
+  EXPECT_EQ(img.type(), CV_8UC3);
+  cv::Point p = r.GetPixel(ralphs);
+  ASSERT_TRUE(p.x >= 0 && p.x < img.cols && p.y >= 0 && p.y < img.rows);
+  EXPECT_EQ(img.at<cv::Vec3b>(p.y, p.x), cv::Vec3b(0, 0, 255));  // BGR red
+
+  // Unknown ids leave the map untouched
+  EXPECT_EQ(cv::norm(r.RenderPoints({"no such id"}), r.BaseImage(), cv::NORM_INF), 0);
+  EXPECT_EQ(cv::norm(r.RenderRoute({"no such id", "either"}), r.BaseImage(), cv::NORM_INF), 0);
+
+  // Other viewports get their own size
+  Viewport half;
+  half.width = 640;
+  half.height = 450;
+  MapRenderer small(m, half);
+  cv::Mat route = small.RenderRoute({ralphs, m.GetID("Target")});
+  EXPECT_EQ(route.cols, 640);
+  EXPECT_EQ(route.rows, 450);
+}
+
+// Test that PNG encoding is lossless
+TEST(MapRendererTest, Encode) {
+  TrojanMap m;
+  MapRenderer r(m);
+  cv::Mat img = r.RenderRoute({m.GetID("Ralphs"), m.GetID("Target")});
+  std::vector<uchar> bytes = MapRenderer::Encode(img);
+  ASSERT_FALSE(bytes.empty());
+  cv::Mat decoded = cv::imdecode(bytes, cv::IMREAD_COLOR);
+  ASSERT_EQ(decoded.size(), img.size());
+  EXPECT_EQ(cv::norm(img, decoded, cv::NORM_INF), 0);
+  EXPECT_TRUE(MapRenderer::Encode(cv::Mat()).empty());
+}
+
+// Test one renderer shared by several threads
+TEST(MapRendererTest, Concurrent) {
+  TrojanMap m;
+  MapRenderer r(m);
+  std::vector<std::string> route{m.GetID("Ralphs"), m.GetID("Chick-fil-A"), m.GetID("Target")};
+  cv::Mat expected = MapRenderer(m).RenderRoute(route);
+
+  const int kThreads = 4;
+  std::vector<cv::Mat> routes(kThreads);
+  std::vector<const cv::Mat *> layers(kThreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t]() {
+      layers[t] = &r.RoadLayer();
+      for (int i = 0; i < 5; i++) routes[t] = r.RenderRoute(route);
+    });
+  }
+  for (auto &t : threads) t.join();
+  for (int t = 0; t < kThreads; t++) {
+    EXPECT_EQ(layers[t], layers[0]);  // drawn once
+    EXPECT_EQ(cv::norm(routes[t], expected, cv::NORM_INF), 0);
+  }
+  EXPECT_FALSE(layers[0]->empty());
+}
@@ -1,3 +1,7 @@
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <set>
 #include <vector>
 #include <unordered_set>
 #include "gtest/gtest.h"
@@ -184,6 +188,183 @@ TEST(TrojanMapTest, TopologicalSort) {
 }
 
 
+// Test ties, cycles and large inputs of the topological sort
+TEST(TrojanMapTest, TopologicalSort_Kahn) {
+  TrojanMap m;
+  std::vector<std::string> locations = {"Ralphs", "Chick-fil-A", "KFC", "Bank of America", "Arco"};
+  std::vector<std::vector<std::string>> dependencies = {{"Ralphs", "KFC"}, {"Ralphs", "Chick-fil-A"}, {"KFC", "Chick-fil-A"},
+                                                        {"Arco", "Ralphs"}, {"Bank of America", "Arco"}, {"Arco", "KFC"},
+                                                        {"Bank of America", "KFC"}};
+  std::vector<std::string> gt = {"Bank of America", "Arco", "Ralphs", "KFC", "Chick-fil-A"};
+  EXPECT_EQ(m.DeliveringTrojan(locations, dependencies), gt);
+
+  // Rows longer than two are chains; without dependencies names are sorted
+  locations = {"d", "c", "b", "a", "e"};
+  dependencies = {{"d", "c", "b"}};
+  EXPECT_EQ(m.DeliveringTrojan(locations, dependencies), std::vector<std::string>({"a", "d", "c", "b", "e"}));
+
+  // A cycle gives no order, and the cycle is reported in edge order
+  locations = {"a", "b", "c", "d", "e"};
+  dependencies = {{"d", "a"}, {"a", "b"}, {"b", "c"}, {"c", "a"}, {"c", "e"}};
+  std::vector<std::string> cycle;
+  EXPECT_TRUE(m.DeliveringTrojan(locations, dependencies, &cycle).empty());
+  ASSERT_EQ(cycle.size(), 3);
+  std::rotate(cycle.begin(), std::find(cycle.begin(), cycle.end(), "a"), cycle.end());
+  EXPECT_EQ(cycle, std::vector<std::string>({"a", "b", "c"}));
+
+  // 20000 locations and 100000 dependencies
+  std::mt19937 gen(7);
+  int n = 20000;
+  std::vector<std::string> names;
+  for (int i = 0; i < n; i++) names.push_back("L" + std::to_string(i));
+  std::vector<std::vector<std::string>> many;
+  std::uniform_int_distribution<int> pick(0, n - 1);
+  for (int e = 0; e < 100000; e++) {
+    int a = pick(gen), b = pick(gen);
+    if (a == b) continue;
+    many.push_back({names[std::min(a, b)], names[std::max(a, b)]});
+  }
+  std::vector<std::string> shuffled = names;
+  std::shuffle(shuffled.begin(), shuffled.end(), gen);
+  auto order = m.DeliveringTrojan(shuffled, many);
+  ASSERT_EQ(order.size(), n);
+  std::unordered_map<std::string, int> position;
+  for (int i = 0; i < n; i++) position[order[i]] = i;
+  for (auto &d : many) EXPECT_LT(position[d[0]], position[d[1]]);
+}
+
+// Test dependency levels, critical path and courier schedule
+TEST(TrojanMapTest, DeliveringTrojanLevels) {
+  TrojanMap m;
+  std::vector<std::string> locations = {"a", "b", "c", "d", "e"};
+  std::vector<std::vector<std::string>> dependencies = {{"a", "b", "d"}, {"a", "c"}, {"c", "d"}};
+  auto result = m.DeliveringTrojanLevels(locations, dependencies, 2);
+  std::vector<std::vector<std::string>> levels = {{"a", "e"}, {"b", "c"}, {"d"}};
+  EXPECT_EQ(result.levels, levels);
+  EXPECT_EQ(result.critical_path, std::vector<std::string>({"a", "b", "d"}));
+  EXPECT_EQ(result.schedule, levels);
+  EXPECT_TRUE(result.cycle.empty());
+  std::vector<std::vector<std::string>> one = {{"a"}, {"b"}, {"c"}, {"d"}, {"e"}};
+  EXPECT_EQ(m.DeliveringTrojanLevels(locations, dependencies, 1).schedule, one);
+
+  dependencies.push_back({"d", "a"});
+  result = m.DeliveringTrojanLevels(locations, dependencies, 2);
+  EXPECT_TRUE(result.levels.empty());
+  EXPECT_FALSE(result.cycle.empty());
+
+  // 20000 locations and 100000 dependencies on 8 couriers
+  std::mt19937 gen(11);
+  int n = 20000;
+  std::vector<std::string> names;
+  for (int i = 0; i < n; i++) names.push_back("L" + std::to_string(i));
+  std::vector<std::vector<std::string>> many;
+  std::uniform_int_distribution<int> pick(0, n - 1);
+  for (int e = 0; e < 100000; e++) {
+    int a = pick(gen), b = pick(gen);
+    if (a != b) many.push_back({names[std::min(a, b)], names[std::max(a, b)]});
+  }
+  result = m.DeliveringTrojanLevels(names, many, 8);
+  std::unordered_map<std::string, int> level, step;
+  for (int l = 0; l < int(result.levels.size()); l++) {
+    for (auto &x : result.levels[l]) level[x] = l;
+  }
+  for (int t = 0; t < int(result.schedule.size()); t++) {
+    EXPECT_LE(result.schedule[t].size(), 8);
+    for (auto &x : result.schedule[t]) step[x] = t;
+  }
+  ASSERT_EQ(level.size(), n);
+  ASSERT_EQ(step.size(), n);
+  for (auto &d : many) {
+    EXPECT_LT(level[d[0]], level[d[1]]);
+    EXPECT_LT(step[d[0]], step[d[1]]);
+  }
+  EXPECT_EQ(result.critical_path.size(), result.levels.size());
+  EXPECT_GE(result.schedule.size(), std::max<size_t>(result.levels.size(), n / 8));
+}
+
+// Test the precedence-constrained delivery route
+TEST(TrojanMapTest, DeliveringTrojanRoute) {
+  TrojanMap m;
+  // Names that GetID resolves, i.e. held by exactly one location
+  std::vector<std::string> names;
+  std::unordered_map<std::string, std::string> id_of;
+  std::unordered_map<std::string, int> uses;
+  for (auto &id : m.index_to_id) uses[m.data[id].name]++;
+  for (auto &id : m.index_to_id) {
+    auto &name = m.data[id].name;
+    if (!name.empty() && uses[name] == 1) {
+      id_of[name] = id;
+      names.push_back(name);
+    }
+  }
+  ASSERT_GE(names.size(), 300);
+  auto respects = [](const std::vector<std::string> &route,
+                     const std::vector<std::vector<std::string>> &deps) {
+    std::unordered_map<std::string, int> at;
+    for (int i = 0; i < int(route.size()); i++) at[route[i]] = i;
+    for (auto &d : deps) {
+      if (at[d[0]] > at[d[1]]) return false;
+    }
+    return true;
+  };
+
+  // Exact: compare with every permutation of 7 locations
+  std::mt19937 gen(5);
+  for (int trial = 0; trial < 5; trial++) {
+    std::vector<std::string> stops(names.begin() + trial * 7, names.begin() + trial * 7 + 7);
+    std::vector<std::vector<std::string>> deps = {{stops[0], stops[3]}, {stops[4], stops[1]}, {stops[2], stops[6]}, {stops[6], stops[5]}};
+    auto route = m.DeliveringTrojanRoute(stops, deps);
+    ASSERT_EQ(route.second.size(), stops.size());
+    EXPECT_TRUE(respects(route.second, deps));
+    std::vector<std::string> perm = stops;
+    std::sort(perm.begin(), perm.end());
+    double best = DBL_MAX;
+    do {
+      if (!respects(perm, deps)) continue;
+      double length = 0;
+      for (int i = 0; i + 1 < 7; i++) length += m.CalculateDistance(id_of[perm[i]], id_of[perm[i + 1]]);
+      best = std::min(best, length);
+    } while (std::next_permutation(perm.begin(), perm.end()));
+    EXPECT_NEAR(route.first, best, 1e-9);
+  }
+
+  // Local search: valid, and close to the exact answer on 16 locations
+  std::vector<std::string> sixteen(names.begin(), names.begin() + 16);
+  std::vector<std::vector<std::string>> deps;
+  for (int i = 0; i + 4 < 16; i += 3) deps.push_back({sixteen[i], sixteen[i + 4]});
+  DependencyGraph graph = m.BuildDependencyGraph(sixteen, deps);
+  std::vector<std::string> ids;
+  for (auto &name : graph.names) ids.push_back(id_of[name]);
+  DistanceMatrix dist = m.BuildDistanceMatrix(ids);
+  auto exact = m.PrecedenceRoute_Exact(dist, graph);
+  auto local = m.PrecedenceRoute_LocalSearch(dist, graph);
+  EXPECT_NEAR(m.DeliveringTrojanRoute(sixteen, deps).first, exact.first, 1e-9);
+  EXPECT_GE(local.first, exact.first - 1e-9);
+  EXPECT_LT(local.first, exact.first * 1.3);
+  std::vector<std::string> seventeen(names.begin(), names.begin() + TrojanMap::kMaxPrecedenceExact + 1);
+  QueryContext too_large;
+  EXPECT_EQ(m.PrecedenceRoute_Exact(DistanceMatrix(seventeen.size()), m.BuildDependencyGraph(seventeen, {}), &too_large).first, -1);
+  EXPECT_EQ(too_large.status, QueryStatus::kTooLarge);
+
+  // 300 locations with 200 dependencies
+  std::vector<std::string> many(names.begin(), names.begin() + 300);
+  deps.clear();
+  std::uniform_int_distribution<int> pick(0, 299);
+  for (int e = 0; e < 200; e++) {
+    int a = pick(gen), b = pick(gen);
+    if (a != b) deps.push_back({many[std::min(a, b)], many[std::max(a, b)]});
+  }
+  auto route = m.DeliveringTrojanRoute(many, deps);
+  ASSERT_EQ(route.second.size(), many.size());
+  EXPECT_TRUE(respects(route.second, deps));
+  EXPECT_EQ(std::unordered_set<std::string>(route.second.begin(), route.second.end()).size(), many.size());
+
+  // Cycles and unknown names
+  deps = {{many[0], many[1]}, {many[1], many[0]}};
+  EXPECT_EQ(m.DeliveringTrojanRoute(many, deps).first, -1);
+  EXPECT_EQ(m.DeliveringTrojanRoute({"Ralphs", "no such place"}, {}).first, -1);
+}
+
 // Phase 3
 // Test TSP function
 TEST(TrojanMapTest, TSP1) {
@@ -247,4 +428,729 @@ TEST(TrojanMapTest, FindNearby) {
   auto result = m.FindNearby("supermarket", "Ralphs", 10, 10);
   std::vector<std::string> ans{"5237417649", "6045067406", "7158034317"};
   EXPECT_EQ(result, ans);
-}
\ No newline at end of file
+}
+// Test isochrone queries
+TEST(TrojanMapTest, Isochrone) {
+  TrojanMap m;
+
+  auto result = m.Isochrone("2578244375", 0.5); // Ralphs
+  ASSERT_FALSE(result.reached.empty());
+  EXPECT_EQ(result.reached[0].first, "2578244375");
+  EXPECT_EQ(result.reached[0].second, 0);
+  std::unordered_set<std::string> reached;
+  for (int i = 0; i < int(result.reached.size()); i++) {
+    EXPECT_LE(result.reached[i].second, 0.5);
+    if (i > 0) {
+      EXPECT_LE(result.reached[i - 1].second, result.reached[i].second);
+    }
+    reached.insert(result.reached[i].first);
+  }
+  EXPECT_FALSE(result.boundary_edges.empty());
+  for (auto &edge : result.boundary_edges) {
+    EXPECT_EQ(reached.count(edge.first), 1);
+    EXPECT_EQ(reached.count(edge.second), 0);
+  }
+  EXPECT_GE(result.polygon.size(), 3);
+
+  // A larger budget reaches a superset
+  auto larger = m.Isochrone("2578244375", 1.0);
+  EXPECT_GT(larger.reached.size(), result.reached.size());
+
+  // Multi-threaded runs give the same answer
+  std::vector<std::string> sources = {"2578244375", "5237417650", "unknown"};
+  auto results = m.Isochrones(sources, 0.5, 3);
+  ASSERT_EQ(results.size(), 3);
+  EXPECT_EQ(results[0].reached, result.reached);
+  EXPECT_TRUE(results[2].reached.empty());
+  EXPECT_EQ(m.CategoryIsochrones("supermarket", 0.5).size(),
+            m.GetAllLocationsFromCategory("supermarket").size());
+}
+
+// Test nearest facility labels against per-node isochrones
+TEST(TrojanMapTest, NearestFacility) {
+  TrojanMap m;
+
+  // A supermarket is its own nearest supermarket
+  auto self = m.NearestFacility("supermarket", "2578244375"); // Ralphs
+  EXPECT_EQ(self.first, "2578244375");
+  EXPECT_EQ(self.second, 0);
+
+  // Target's nearest bank must be the first bank its isochrone reaches
+  auto nearest = m.NearestFacility("bank", "5237417650");
+  ASSERT_NE(nearest.first, "");
+  auto area = m.Isochrone("5237417650", nearest.second);
+  std::string first_bank;
+  for (auto &r : area.reached) {
+    if (m.data[r.first].attributes.count("bank")) {
+      first_bank = r.first;
+      break;
+    }
+  }
+  EXPECT_EQ(first_bank, nearest.first);
+  EXPECT_EQ(area.reached.back().second, nearest.second);
+
+  // Unknown inputs
+  EXPECT_EQ(m.NearestFacility("no_such_category", "5237417650").second, -1);
+  EXPECT_EQ(m.NearestFacility("bank", "unknown").second, -1);
+}
+
+// Eight stops of the Phase 3 tests and their optimal tour
+const std::vector<std::string> kEightStops{"6819019976","6820935923","122702233","8566227783","8566227656","6816180153","1873055993","7771782316"};
+const std::vector<std::string> kEightStopsTour{"6819019976","1873055993","8566227656","122702233","8566227783","6816180153","7771782316","6820935923","6819019976"};
+
+// Expect path to be the closed tour gt, travelled in either direction
+void ExpectSameCycle(const std::vector<std::string> &gt, const std::vector<std::string> &path) {
+  std::vector<std::string> reversed(gt.rbegin(), gt.rend());
+  EXPECT_TRUE(path == gt || path == reversed) << "not the expected tour in either direction";
+}
+
+// Expect path to visit every stop once and return to the first one
+void ExpectClosedTour(const std::vector<std::string> &stops, const std::vector<std::string> &path) {
+  ASSERT_EQ(path.size(), stops.size() + 1);
+  EXPECT_EQ(path.front(), stops[0]);
+  EXPECT_EQ(path.back(), stops[0]);
+  EXPECT_EQ(std::set<std::string>(path.begin(), path.end() - 1), std::set<std::string>(stops.begin(), stops.end()));
+}
+
+// Expect every progress entry to be no longer than the one before
+void ExpectImproving(TrojanMap &m, const std::vector<std::vector<std::string>> &progress) {
+  for (size_t i = 1; i < progress.size(); i++) {
+    EXPECT_LE(m.CalculatePathLength(progress[i]), m.CalculatePathLength(progress[i - 1]) + 1e-9);
+  }
+}
+
+// Test Held-Karp TSP against brute force
+TEST(TrojanMapTest, TSP_HeldKarp) {
+  TrojanMap m;
+
+  // Exact: the optimal tour and its length
+  auto result = m.TravelingTrojan_HeldKarp(kEightStops);
+  ExpectSameCycle(kEightStopsTour, result.second.back());
+  EXPECT_DOUBLE_EQ(result.first, m.CalculatePathLength(kEightStopsTour));
+
+  // 18 stops: never worse than 2-opt, threading does not change the answer
+  std::vector<std::string> stops(m.index_to_id.begin(), m.index_to_id.begin() + 18);
+  auto exact = m.TravelingTrojan_HeldKarp(stops);
+  EXPECT_LE(exact.first, m.TravelingTrojan_2opt(stops).first + 1e-9);
+  EXPECT_DOUBLE_EQ(exact.first, m.CalculatePathLength(exact.second.back()));
+  auto threaded = m.TSP_HeldKarp(m.BuildDistanceMatrix(stops), 4);
+  EXPECT_DOUBLE_EQ(threaded.first, exact.first);
+
+  EXPECT_TRUE(m.TravelingTrojan_HeldKarp({}).second.empty());
+}
+
+// Test branch and bound TSP
+TEST(TrojanMapTest, TSP_BranchAndBound) {
+  TrojanMap m;
+
+  // Exact, and the progress lists ever better incumbents
+  auto result = m.TravelingTrojan_BranchAndBound(kEightStops);
+  ExpectSameCycle(kEightStopsTour, result.second.back());
+  EXPECT_NEAR(result.first, m.CalculatePathLength(kEightStopsTour), 1e-9);
+  ExpectImproving(m, result.second);
+
+  // Matches Held-Karp on a larger input
+  std::vector<std::string> stops;
+  for (int i = 0; i < 14; i++) stops.push_back(m.index_to_id[i * 997]);
+  auto exact = m.TravelingTrojan_HeldKarp(stops);
+  auto bb = m.TravelingTrojan_BranchAndBound(stops);
+  EXPECT_NEAR(bb.first, exact.first, 1e-9);
+  EXPECT_DOUBLE_EQ(bb.first, m.CalculatePathLength(bb.second.back()));
+}
+
+// Test parallel exact TSP
+TEST(TrojanMapTest, TSP_Parallel) {
+  TrojanMap m;
+
+  std::vector<std::string> stops;
+  for (int i = 0; i < 13; i++) stops.push_back(m.index_to_id[i * 1013]);
+  auto exact = m.TravelingTrojan_HeldKarp(stops);
+  auto single = m.TravelingTrojan_Parallel(stops, 2, 1);
+  EXPECT_NEAR(single.first, exact.first, 1e-9);
+  EXPECT_DOUBLE_EQ(single.first, m.CalculatePathLength(single.second.back()));
+
+  // Same tour regardless of thread count and split depth
+  for (int threads : {2, 4}) {
+    for (int depth : {1, 3}) {
+      auto result = m.TravelingTrojan_Parallel(stops, depth, threads);
+      EXPECT_EQ(result.second.back(), single.second.back());
+    }
+  }
+}
+
+// Test 2-opt on a large input
+TEST(TrojanMapTest, TSP_2opt_Large) {
+  TrojanMap m;
+
+  std::vector<std::string> stops;
+  for (int i = 0; i < 1000; i++) stops.push_back(m.index_to_id[i * 18]);
+  std::vector<std::string> input_order = stops;
+  input_order.push_back(stops[0]);
+  auto result = m.TravelingTrojan_2opt(stops);
+  auto &path = result.second.back();
+  ASSERT_EQ(path.size(), stops.size() + 1);
+  EXPECT_EQ(path.front(), stops[0]);
+  EXPECT_EQ(path.back(), stops[0]);
+  EXPECT_EQ(std::unordered_set<std::string>(path.begin(), path.end()).size(), stops.size());
+  EXPECT_NEAR(result.first, m.CalculatePathLength(path), 1e-9);
+  EXPECT_LT(result.first, m.CalculatePathLength(input_order) / 5);
+}
+
+// Test 3-opt
+TEST(TrojanMapTest, TSP_3opt) {
+  TrojanMap m;
+
+  // Local search: a closed tour, every sweep no worse than the last, and
+  // never shorter than the optimum
+  auto result = m.TravelingTrojan_3opt(kEightStops);
+  ExpectClosedTour(kEightStops, result.second.back());
+  ExpectImproving(m, result.second);
+  EXPECT_GE(result.first, m.CalculatePathLength(kEightStopsTour) - 1e-9);
+
+  // Or-opt moves find what 2-opt alone misses
+  std::vector<std::string> stops;
+  for (int i = 0; i < 500; i++) stops.push_back(m.index_to_id[i * 36]);
+  auto two = m.TravelingTrojan_2opt(stops);
+  auto three = m.TravelingTrojan_3opt(stops);
+  auto &path = three.second.back();
+  EXPECT_EQ(std::unordered_set<std::string>(path.begin(), path.end()).size(), stops.size());
+  EXPECT_NEAR(three.first, m.CalculatePathLength(path), 1e-9);
+  EXPECT_LT(three.first, two.first);
+}
+
+// Test tour construction heuristics
+TEST(TrojanMapTest, TSP_InitialTour) {
+  TrojanMap m;
+  std::vector<std::string> stops;
+  for (int i = 0; i < 400; i++) stops.push_back(m.index_to_id[i * 45]);
+  DistanceMatrix dist = m.BuildDistanceMatrix(stops);
+  auto coords = m.GetCoordinates(stops);
+  auto closed_length = [&](std::vector<int> order) {
+    order.push_back(order[0]);
+    return TrojanMap::TourLength(dist, order);
+  };
+  double local = m.TSP_3opt(dist).first;
+  double input_order =
+      closed_length(m.TSP_InitialTour(dist, TourSeed::kInputOrder));
+  for (auto seed : {TourSeed::kNearestNeighbor, TourSeed::kGreedyEdge,
+                    TourSeed::kChristofides, TourSeed::kSpaceFillingCurve}) {
+    auto order = m.TSP_InitialTour(dist, seed, coords);
+    ASSERT_EQ(order.size(), stops.size());
+    EXPECT_EQ(order[0], 0);
+    EXPECT_EQ(std::unordered_set<int>(order.begin(), order.end()).size(), stops.size());
+    double length = closed_length(order);
+    EXPECT_LT(length, input_order / 3);
+    EXPECT_LT(length, local * (seed == TourSeed::kSpaceFillingCurve ? 2.0 : 1.5));
+  }
+  // The space-filling curve needs coordinates and falls back otherwise
+  EXPECT_EQ(m.TSP_InitialTour(dist, TourSeed::kSpaceFillingCurve),
+            m.TSP_InitialTour(dist, TourSeed::kNearestNeighbor));
+  // Tiny inputs
+  DistanceMatrix two = m.BuildDistanceMatrix({stops[0], stops[1]});
+  EXPECT_EQ(m.TSP_InitialTour(two, TourSeed::kChristofides), std::vector<int>({0, 1}));
+}
+
+// Test compact progress recording
+TEST(TrojanMapTest, TSPProgress) {
+  TrojanMap m;
+  std::vector<std::string> stops;
+  for (int i = 0; i < 500; i++) stops.push_back(m.index_to_id[i * 36]);
+  DistanceMatrix dist = m.BuildDistanceMatrix(stops);
+  auto full = m.TSP_3opt(dist);
+
+  // Replaying the moves gives the first tour and then every sweep
+  TSPProgress progress;
+  int seen = 0;
+  progress.Subscribe([&](const std::vector<int> &) { seen++; });
+  auto result = m.TSP_3opt(dist, {}, 10, &progress);
+  EXPECT_EQ(result.first, full.first);
+  EXPECT_EQ(result.second.size(), 1);
+  std::vector<std::vector<int>> frames;
+  progress.Replay([&](const std::vector<int> &tour) { frames.push_back(tour); });
+  ASSERT_EQ(frames.size(), full.second.size() + 1);
+  EXPECT_EQ(seen + 1, frames.size());
+  for (size_t i = 0; i < full.second.size(); i++) {
+    EXPECT_EQ(frames[i + 1], full.second[i]);
+  }
+
+  // A small capacity keeps only the latest frames. At every frame, even the
+  // oldest frame held is a real frame and not a tour from mid-sweep.
+  TSPProgress bounded(200);
+  int checked = 0;
+  bounded.Subscribe([&](const std::vector<int> &) {
+    std::vector<std::vector<int>> kept;
+    bounded.Replay([&](const std::vector<int> &tour) { kept.push_back(tour); });
+    ASSERT_EQ(kept.size(), bounded.FrameCount());
+    for (size_t i = 0; i < kept.size(); i++) {
+      EXPECT_EQ(kept[i], frames[bounded.dropped_frames + i]);
+    }
+    checked++;
+  });
+  m.TSP_3opt(dist, {}, 10, &bounded);
+  EXPECT_EQ(checked, seen);
+  EXPECT_GT(bounded.dropped_frames, 0);
+  EXPECT_EQ(bounded.FrameCount() + bounded.dropped_frames, frames.size());
+  std::vector<int> last;
+
+  // Anytime solvers record snapshots of each new best tour
+  TSPProgress lk;
+  auto lk_result = m.TSP_LinKernighan(dist, 50, {}, 8, &lk);
+  lk.Replay([&](const std::vector<int> &tour) { last = tour; });
+  EXPECT_EQ(last, lk_result.second.back());
+}
+
+// Test deadlines and cancellation
+TEST(TrojanMapTest, QueryContext) {
+  TrojanMap m;
+  std::vector<std::string> stops;
+  for (int i = 0; i < 60; i++) stops.push_back(m.index_to_id[i * 300]);
+  std::vector<std::string> few(stops.begin(), stops.begin() + 13);
+
+  // Exact solvers report a timeout and return nothing. The deadlines have
+  // passed before the queries start, so the outcome does not depend on how
+  // fast the machine is.
+  QueryContext bf(0);
+  auto result = m.TravelingTrojan_Brute_force(few, &bf);
+  EXPECT_EQ(bf.status, QueryStatus::kTimeout);
+  EXPECT_TRUE(result.second.empty());
+  QueryContext bt(0);
+  result = m.TravelingTrojan_Backtracking(stops, &bt);
+  EXPECT_EQ(bt.status, QueryStatus::kTimeout);
+  EXPECT_TRUE(result.second.empty());
+  QueryContext hk(0);
+  std::vector<std::string> twenty_one(stops.begin(), stops.begin() + 21);
+  result = m.TravelingTrojan_HeldKarp(twenty_one, &hk);
+  EXPECT_EQ(hk.status, QueryStatus::kTimeout);
+  EXPECT_TRUE(result.second.empty());
+  QueryContext bellman(0);
+  EXPECT_TRUE(m.CalculateShortestPath_Bellman_Ford("Ralphs", "Target", &bellman).empty());
+  EXPECT_EQ(bellman.status, QueryStatus::kTimeout);
+
+  // Exact solvers refuse inputs past their limits instead of guessing
+  std::vector<std::string> many;
+  for (int i = 0; i < TrojanMap::kMaxBranchAndBoundStops + 1; i++) {
+    many.push_back(m.index_to_id[i * 200]);
+  }
+  std::vector<std::string> twenty_two(many.begin(), many.begin() + 22);
+  QueryContext large_hk, large_bb, large_parallel, large_solve;
+  EXPECT_TRUE(m.TravelingTrojan_HeldKarp(twenty_two, &large_hk).second.empty());
+  EXPECT_EQ(large_hk.status, QueryStatus::kTooLarge);
+  EXPECT_TRUE(m.TravelingTrojan_BranchAndBound(many, &large_bb).second.empty());
+  EXPECT_EQ(large_bb.status, QueryStatus::kTooLarge);
+  EXPECT_TRUE(m.TravelingTrojan_Parallel(many, 2, 0, &large_parallel).second.empty());
+  EXPECT_EQ(large_parallel.status, QueryStatus::kTooLarge);
+  EXPECT_TRUE(m.TSP_Solve(m.BuildDistanceMatrix(twenty_two), TSPSolver::kHeldKarp,
+                          1000, &large_solve).second.empty());
+  EXPECT_EQ(large_solve.status, QueryStatus::kTooLarge);
+
+  // Anytime solvers return their best tour so far as partial
+  QueryContext cancelled;
+  cancelled.Cancel();
+  result = m.TravelingTrojan_LinKernighan(stops, 10000, nullptr, 0, &cancelled);
+  EXPECT_EQ(cancelled.status, QueryStatus::kPartial);
+  ASSERT_FALSE(result.second.empty());
+  EXPECT_EQ(result.second.back().size(), stops.size() + 1);
+
+  // Cancellation from another thread; without it the run would take 10 s
+  QueryContext ctx;
+  std::thread canceller([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ctx.Cancel();
+  });
+  result = m.TravelingTrojan_MultiStart(stops, 10000, 2, 0, 0, &ctx);
+  canceller.join();
+  EXPECT_EQ(ctx.status, QueryStatus::kPartial);
+  EXPECT_NEAR(result.first, m.CalculatePathLength(result.second.back()), 1e-9);
+
+  // A query that finishes in time is complete
+  QueryContext generous(60000);
+  result = m.TravelingTrojan_3opt(stops, TourSeed::kGreedyEdge, nullptr, &generous);
+  EXPECT_EQ(generous.status, QueryStatus::kComplete);
+  EXPECT_EQ(result.second.back().size(), stops.size() + 1);
+}
+
+// Test Lin-Kernighan
+TEST(TrojanMapTest, TSP_LinKernighan) {
+  TrojanMap m;
+
+  // Anytime: a closed tour, each recorded tour a new best, and never shorter
+  // than the optimum
+  auto result = m.TravelingTrojan_LinKernighan(kEightStops, 60000, nullptr, 50);
+  ExpectClosedTour(kEightStops, result.second.back());
+  ExpectImproving(m, result.second);
+  EXPECT_GE(result.first, m.CalculatePathLength(kEightStopsTour) - 1e-9);
+
+  // A fixed number of kicks is reproducible and beats plain local search on
+  // a large tour
+  std::vector<std::string> stops;
+  for (int i = 0; i < 1000; i++) stops.push_back(m.index_to_id[i * 18]);
+  auto lk = m.TravelingTrojan_LinKernighan(stops, 60000, nullptr, 200);
+  EXPECT_EQ(m.TravelingTrojan_LinKernighan(stops, 60000, nullptr, 200).second.back(), lk.second.back());
+  auto &path = lk.second.back();
+  EXPECT_EQ(std::unordered_set<std::string>(path.begin(), path.end()).size(), stops.size());
+  EXPECT_NEAR(lk.first, m.CalculatePathLength(path), 1e-9);
+  EXPECT_LT(lk.first, m.TravelingTrojan_3opt(stops).first);
+}
+
+// Test multi-start iterated local search
+TEST(TrojanMapTest, TSP_MultiStart) {
+  TrojanMap m;
+
+  std::vector<std::string> stops;
+  for (int i = 0; i < 300; i++) stops.push_back(m.index_to_id[i * 60]);
+  auto first = m.TravelingTrojan_MultiStart(stops, 60000, 4, 7, 3);
+  auto second = m.TravelingTrojan_MultiStart(stops, 60000, 4, 7, 3);
+  EXPECT_EQ(first.second.back(), second.second.back()); // reproducible
+  auto &path = first.second.back();
+  EXPECT_EQ(std::unordered_set<std::string>(path.begin(), path.end()).size(), stops.size());
+  EXPECT_NEAR(first.first, m.CalculatePathLength(path), 1e-9);
+  EXPECT_LT(first.first, m.TravelingTrojan_3opt(stops).first);
+
+  // Out of time before the first epoch it still returns a complete tour
+  QueryContext expired(0);
+  auto rushed = m.TravelingTrojan_MultiStart(stops, 0, 4, 7, 0, &expired);
+  ASSERT_FALSE(rushed.second.empty());
+  EXPECT_EQ(rushed.second.back().size(), stops.size() + 1);
+  EXPECT_EQ(expired.status, QueryStatus::kPartial);
+}
+
+// Test TSP on road distances
+TEST(TrojanMapTest, TSP_Road) {
+  TrojanMap m;
+
+  std::vector<std::string> input = kEightStops;
+  auto road = m.BuildRoadDistanceMatrix(input);
+  auto line = m.BuildDistanceMatrix(input);
+  for (int i = 0; i < road.n; i++) {
+    for (int j = 0; j < road.n; j++) {
+      EXPECT_GE(road(i, j) + 1e-9, line(i, j));
+      EXPECT_NEAR(road(i, j), road(j, i), 1e-9);
+    }
+  }
+  // The same stops in another order come from the cache, reordered
+  std::vector<std::string> reversed(input.rbegin(), input.rend());
+  auto reordered = m.BuildRoadDistanceMatrix(reversed);
+  EXPECT_EQ(m.road_matrix_cache.Size(), 1);
+  int n = input.size();
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      EXPECT_EQ(reordered(n - 1 - i, n - 1 - j), road(i, j));
+    }
+  }
+  RoadMatrixCache small(2);
+  for (int i = 0; i < 3; i++) {
+    small.Insert(std::to_string(i), std::make_shared<DistanceMatrix>(1));
+  }
+  EXPECT_EQ(small.Size(), 2);
+  EXPECT_EQ(small.Find("0"), nullptr);  // least recently used went first
+  EXPECT_NE(small.Find("2"), nullptr);
+
+  std::vector<std::string> path;
+  auto result = m.TravelingTrojan_Road(input, TSPSolver::kHeldKarp, &path);
+  auto exact_line = m.TravelingTrojan_HeldKarp(input);
+  EXPECT_GE(result.first, exact_line.first);
+  // The expanded path follows roads and has the same length as the tour
+  ASSERT_FALSE(path.empty());
+  EXPECT_EQ(path.front(), input[0]);
+  EXPECT_EQ(path.back(), input[0]);
+  for (int i = 0; i + 1 < int(path.size()); i++) {
+    auto neighbors = m.GetNeighborIDs(path[i]);
+    EXPECT_NE(std::find(neighbors.begin(), neighbors.end(), path[i + 1]), neighbors.end());
+  }
+  EXPECT_NEAR(m.CalculatePathLength(path), result.first, 1e-6);
+
+  // Every solver runs on the road matrix
+  auto local = m.TravelingTrojan_Road(input, TSPSolver::k2opt);
+  EXPECT_GE(local.first + 1e-9, result.first);
+
+  // Stops the roads cannot connect give no tour
+  int home = m.connectivity.component[m.id_to_index[input[0]]];
+  std::string island;
+  for (int i = 0; i < int(m.index_to_id.size()) && island.empty(); i++) {
+    if (m.connectivity.component[i] != home) island = m.index_to_id[i];
+  }
+  ASSERT_FALSE(island.empty());
+  for (auto extra : {island, std::string("no such id")}) {
+    auto cut_off = input;
+    cut_off.push_back(extra);
+    result = m.TravelingTrojan_Road(cut_off, TSPSolver::k3opt, &path);
+    EXPECT_TRUE(result.second.empty());
+    EXPECT_TRUE(path.empty());
+  }
+}
+
+// Test the CSV reader on quoting, padding, CRLF and blank lines
+TEST(TrojanMapTest, CSVReader) {
+  std::vector<std::vector<std::string>> rows;
+  CSVReader::ForEachRow(
+      "Source, Destination\r\n"
+      "  Ralphs ,\tKFC\r\n"
+      "\r\n"
+      "\"Chick-fil-A\",\"Target, Inc\"\n"
+      "\"Say \"\"Hi\"\"\", \"two\nlines\" \n"
+      "\n"
+      "last,",
+      [&](const std::vector<std::string_view> &fields) {
+        rows.emplace_back(fields.begin(), fields.end());
+        return true;
+      });
+  std::vector<std::vector<std::string>> gt{
+      {"Source", "Destination"},   {"Ralphs", "KFC"},
+      {"Chick-fil-A", "Target, Inc"}, {"Say \"Hi\"", "two\nlines"},
+      {"last", ""}};
+  EXPECT_EQ(rows, gt);
+
+  std::string path = testing::TempDir() + "trojanmap_csv_test.csv";
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << "Source, Destination\r\nRalphs,\"KFC\"\r\nKFC , Chick-fil-A\r\n\r\n";
+  }
+  TrojanMap m;
+  std::vector<std::vector<std::string>> deps{{"Ralphs", "KFC"},
+                                             {"KFC", "Chick-fil-A"}};
+  EXPECT_EQ(m.ReadDependenciesFromCSVFile(path), deps);
+  std::vector<std::string> locations{"Ralphs", "KFC", "Chick-fil-A"};
+  auto streamed = m.BuildDependencyGraphFromCSVFile(locations, path);
+  auto built = m.BuildDependencyGraph(locations, deps);
+  EXPECT_EQ(streamed.names, built.names);
+  EXPECT_EQ(streamed.offset, built.offset);
+  EXPECT_EQ(streamed.target, built.target);
+  EXPECT_EQ(streamed.indegree, built.indegree);
+  std::remove(path.c_str());
+
+  std::vector<std::string> gt_locations{
+      "Ralphs", "KFC", "Chick-fil-A", "Target", "Burger King", "Food 4 Less",
+      "CVS Pharmacy"};
+  EXPECT_EQ(m.ReadLocationsFromCSVFile("input/topologicalsort_locations.csv"),
+            gt_locations);
+  EXPECT_TRUE(m.ReadLocationsFromCSVFile("input/no_such_file.csv").empty());
+}
+
+// Test that the chunked loader gives the same map for any thread count
+TEST(TrojanMapTest, CreateGraphFromCSVFile) {
+  TrojanMap m;
+  EXPECT_EQ(m.data.size(), 18358);
+  auto &mcd = m.data["1759017528"];
+  EXPECT_EQ(mcd.name, "McDonalds");
+  EXPECT_DOUBLE_EQ(mcd.lat, 34.0107501);
+  EXPECT_DOUBLE_EQ(mcd.lon, -118.2818990);
+  EXPECT_EQ(mcd.attributes, std::unordered_set<std::string>{"fast_food"});
+  EXPECT_EQ(mcd.neighbors, std::vector<std::string>{"358789632"});
+  std::vector<std::string> gt{"1759017528", "6653019473"};
+  EXPECT_EQ(m.data["358789632"].neighbors, gt);
+
+  for (int threads : {1, 3, 8}) {
+    TrojanMap other;
+    other.LoadMap("src/lib/data.csv", threads);
+    ASSERT_EQ(other.data.size(), m.data.size());
+    for (auto &kv : m.data) {
+      auto &n = other.data[kv.first];
+      EXPECT_EQ(n.name, kv.second.name);
+      EXPECT_EQ(n.lat, kv.second.lat);
+      EXPECT_EQ(n.lon, kv.second.lon);
+      EXPECT_EQ(n.neighbors, kv.second.neighbors);
+      EXPECT_EQ(n.attributes, kv.second.attributes);
+    }
+  }
+}
+
+// Test the witness cycle of CycleDetection
+TEST(TrojanMapTest, CycleDetection_Witness) {
+  TrojanMap m;
+  std::vector<double> square1 = {-118.299, -118.264, 34.032, 34.011};
+  auto sub1 = m.GetSubgraph(square1);
+  std::vector<std::string> cycle;
+  EXPECT_TRUE(m.CycleDetection(sub1, square1, &cycle));
+  ASSERT_GE(cycle.size(), 3);
+  std::unordered_set<std::string> inside(sub1.begin(), sub1.end());
+  std::unordered_set<std::string> distinct(cycle.begin(), cycle.end());
+  EXPECT_EQ(distinct.size(), cycle.size());
+  for (size_t i = 0; i < cycle.size(); i++) {
+    EXPECT_EQ(inside.count(cycle[i]), 1);
+    auto neighbors = m.GetNeighborIDs(cycle[i]);
+    auto &next = cycle[(i + 1) % cycle.size()];
+    EXPECT_NE(std::find(neighbors.begin(), neighbors.end(), next),
+              neighbors.end());
+  }
+
+  std::vector<double> square2 = {-118.290, -118.289, 34.030, 34.020};
+  auto sub2 = m.GetSubgraph(square2);
+  EXPECT_FALSE(m.CycleDetection(sub2, square2, &cycle));
+  EXPECT_TRUE(cycle.empty());
+}
+
+// Test that AnalyzeRegions agrees with GetSubgraph and CycleDetection
+TEST(TrojanMapTest, AnalyzeRegions) {
+  TrojanMap m;
+  std::vector<std::vector<double>> squares{
+      {-118.299, -118.264, 34.032, 34.011},
+      {-118.290, -118.289, 34.030, 34.020},
+      {-118.250, -118.299, 34.030, 34.020},  // left and right swapped
+      {-117.0, -116.0, 34.030, 34.020}};     // off the map
+  std::mt19937 rng(45);
+  std::uniform_real_distribution<double> lon(-118.320, -118.250);
+  std::uniform_real_distribution<double> lat(34.000, 34.040);
+  std::uniform_real_distribution<double> size(0.001, 0.02);
+  for (int i = 0; i < 30; i++) {
+    double left = lon(rng), lower = lat(rng);
+    squares.push_back({left, left + size(rng), lower + size(rng), lower});
+  }
+
+  std::vector<std::vector<std::string>> subgraphs;
+  auto reports = m.AnalyzeRegions(squares, 4, &subgraphs);
+  ASSERT_EQ(reports.size(), squares.size());
+  for (size_t q = 0; q < squares.size(); q++) {
+    auto sub = m.GetSubgraph(squares[q]);
+    std::unordered_set<std::string> gt(sub.begin(), sub.end());
+    std::unordered_set<std::string> got(subgraphs[q].begin(),
+                                        subgraphs[q].end());
+    EXPECT_EQ(got, gt);
+    EXPECT_EQ(reports[q].nodes, sub.size());
+    EXPECT_EQ(reports[q].has_cycle, m.CycleDetection(sub, squares[q]));
+    int edges = 0;
+    for (auto &id : sub) {
+      for (auto &next : m.GetNeighborIDs(id)) edges += gt.count(next);
+    }
+    EXPECT_EQ(reports[q].edges, edges / 2);
+    EXPECT_EQ(reports[q].has_cycle,
+              reports[q].edges > reports[q].nodes - reports[q].components);
+  }
+  EXPECT_TRUE(reports[0].has_cycle);
+  EXPECT_FALSE(reports[1].has_cycle);
+  EXPECT_EQ(reports[2].nodes, 0);
+  EXPECT_EQ(reports[3].nodes, 0);
+
+  auto serial = m.AnalyzeRegions(squares, 1);
+  for (size_t q = 0; q < squares.size(); q++) {
+    EXPECT_EQ(serial[q].components, reports[q].components);
+  }
+}
+
+// Test components, bridges, articulation points and blocks
+TEST(TrojanMapTest, Connectivity) {
+  TrojanMap m;
+  const Connectivity &c = m.connectivity;
+  int n = m.index_to_id.size();
+  // Nodes reachable from source without using node `skip` or road a-b.
+  auto reach = [&](int source, int skip, int a, int b) {
+    std::vector<bool> seen(n, false);
+    std::vector<int> stack{source};
+    seen[source] = true;
+    if (skip >= 0) seen[skip] = true;
+    while (!stack.empty()) {
+      int u = stack.back();
+      stack.pop_back();
+      for (int e = m.adj_offset[u]; e < m.adj_offset[u + 1]; e++) {
+        int v = m.adj_target[e];
+        if ((u == a && v == b) || (u == b && v == a) || seen[v]) continue;
+        seen[v] = true;
+        stack.push_back(v);
+      }
+    }
+    return seen;
+  };
+
+  std::vector<bool> seen(n, false);
+  int components = 0;
+  for (int i = 0; i < n; i++) {
+    if (seen[i]) continue;
+    components++;
+    auto r = reach(i, -1, -1, -1);
+    for (int j = 0; j < n; j++) {
+      if (!r[j]) continue;
+      seen[j] = true;
+      EXPECT_EQ(c.component[j], c.component[i]);
+    }
+  }
+  EXPECT_EQ(c.num_components, components);
+
+  std::mt19937 rng(46);
+  ASSERT_FALSE(c.bridges.empty());
+  for (int k = 0; k < 20; k++) {
+    auto b = c.bridges[rng() % c.bridges.size()];
+    EXPECT_FALSE(reach(b.first, -1, b.first, b.second)[b.second]);
+  }
+  std::set<std::pair<int, int>> bridges(c.bridges.begin(), c.bridges.end());
+  for (int k = 0, tried = 0; tried < 20 && k < 1000; k++) {
+    int u = rng() % n;
+    for (int e = m.adj_offset[u]; e < m.adj_offset[u + 1]; e++) {
+      int v = m.adj_target[e];
+      if (bridges.count({std::min(u, v), std::max(u, v)})) continue;
+      EXPECT_TRUE(reach(u, -1, u, v)[v]);
+      tried++;
+    }
+  }
+
+  // A node is an articulation point iff removing it separates two of its
+  // neighbors.
+  std::vector<bool> is_cut(n, false);
+  for (int a : c.articulation_points) is_cut[a] = true;
+  for (int k = 0; k < 40; k++) {
+    int u = k < 20 ? c.articulation_points[rng() % c.articulation_points.size()]
+                   : rng() % n;
+    if (m.adj_offset[u + 1] - m.adj_offset[u] < 1) continue;
+    auto r = reach(m.adj_target[m.adj_offset[u]], u, -1, -1);
+    bool separates = false;
+    for (int e = m.adj_offset[u]; e < m.adj_offset[u + 1]; e++) {
+      separates |= !r[m.adj_target[e]];
+    }
+    EXPECT_EQ(is_cut[u], separates);
+  }
+
+  // Every road lies in exactly one block.
+  long long roads = m.adj_target.size() / 2, covered = 0;
+  std::vector<int> mark(n, -1);
+  for (size_t b = 0; b < c.blocks.size(); b++) {
+    for (int u : c.blocks[b]) mark[u] = b;
+    for (int u : c.blocks[b]) {
+      for (int e = m.adj_offset[u]; e < m.adj_offset[u + 1]; e++) {
+        int v = m.adj_target[e];
+        if (u < v && mark[v] == int(b)) covered++;
+      }
+    }
+  }
+  EXPECT_EQ(covered, roads);
+
+  // Routing rejects places in different components.
+  int other = 0;
+  while (other < n && c.component[other] == c.component[0]) other++;
+  ASSERT_LT(other, n);
+  std::string a = m.index_to_id[0], b = m.index_to_id[other];
+  EXPECT_FALSE(m.IsReachable(a, b));
+  EXPECT_TRUE(m.IsReachable(a, a));
+  EXPECT_FALSE(m.IsReachable(a, "no such id"));
+  EXPECT_TRUE(m.IsReachable(m.GetID("Ralphs"), m.GetID("Target")));
+}
+
+// Test that routing follows the graph after LoadMap replaces it
+TEST(TrojanMapTest, LoadMap) {
+  TrojanMap m;
+  auto before = m.CalculateShortestPath_Dijkstra("Ralphs", "Target");
+  EXPECT_FALSE(before.empty());
+  m.BuildRoadDistanceMatrix({m.GetID("Ralphs"), m.GetID("Target")});
+  EXPECT_GT(m.road_matrix_cache.Size(), 0);
+
+  std::string path = testing::TempDir() + "trojanmap_load_test.csv";
+  {
+    std::ofstream out(path);
+    out << "id,lat,lon,name,attributes,neighbors\n"
+        << "1,34.0000,-118.3000,Alpha,{'cafe'},{'2'}\n"
+        << "2,34.0010,-118.3000,,,\"{'1', '3'}\"\n"
+        << "3,34.0020,-118.3000,Gamma,,{'2'}\n"
+        << "4,34.0030,-118.3000,Delta,,\n";
+  }
+  m.LoadMap(path);
+  std::remove(path.c_str());
+  EXPECT_EQ(m.data.size(), 4);
+  EXPECT_EQ(m.road_matrix_cache.Size(), 0);
+  EXPECT_EQ(m.connectivity.num_components, 2);
+  std::vector<std::string> gt{"1", "2", "3"};
+  EXPECT_EQ(m.CalculateShortestPath_Dijkstra("Alpha", "Gamma"), gt);
+  EXPECT_EQ(m.CalculateShortestPath_Bellman_Ford("Alpha", "Gamma"), gt);
+  EXPECT_TRUE(m.CalculateShortestPath_Dijkstra("Alpha", "Delta").empty());
+  EXPECT_TRUE(m.CalculateShortestPath_Dijkstra("Ralphs", "Target").empty());
+
+  m.LoadMap();
+  EXPECT_EQ(m.data.size(), 18358);
+  EXPECT_EQ(m.CalculateShortestPath_Dijkstra("Ralphs", "Target"), before);
+}